@@ -1,23 +1,40 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-// we use only one HART (cpu) in fundamental experiments
-#define NCPU 1
+// the maximum number of HARTs (cpus). the actual number is found in the DTS, see init_dtb()
+#define NCPU 8
 
-//interval of timer interrupt. added @lab1_3
+// the maximum number of processes, i.e., applications run in one boot
+#define NPROC 32
+
+// the time slice of round-robin scheduling, in timer ticks
+#define TIME_SLICE_LEN 2
+
+//interval of timer interrupt (the scheduler tick, in mtime ticks). added @lab1_3
 #define TIMER_INTERVAL 1000000
 
 #define DRAM_BASE 0x80000000
 
-/* we use fixed physical (also logical) addresses for the stacks and trap frames as in
- Bare memory-mapping mode */
-// user stack top
-#define USER_STACK 0x81100000
+// the beginning (virtual, also physical) address of PKE kernel
+#define KERN_BASE 0x80000000
+
+// the maximum memory space that PKE is allowed to manage
+#define PKE_MAX_ALLOWABLE_RAM 128 * 1024 * 1024
+
+// virtual address of the stack top of user process, and the size of the user stack.
+// user stack pages are populated on demand.
+#define USER_STACK_TOP 0x7ffff000
+#define USER_STACK_SIZE (16 * 4096)
 
-// the stack used by PKE kernel when a syscall happens
-#define USER_KSTACK 0x81200000
+// virtual address where the page of the syscall rings (kernel/uring.h) is mapped
+#define USER_URING_VA 0x7fe00000
+// virtual address where the time page (kernel/vdso.h) is mapped, read-only
+#define USER_VDSO_VA 0x7fdff000
+// anonymous mappings (SYS_mmap) are placed downward from this address, the heap (SYS_sbrk)
+// grows upward from the end of the elf segments.
+#define USER_MMAP_TOP 0x7f000000
 
-// the trap frame used to assemble the user "process"
-#define USER_TRAP_FRAME 0x81300000
+// host file receiving the collapsed stacks recorded by the sampling profiler (kernel/profile.c)
+#define PROFILE_OUTPUT "pke_profile.folded"
 
 #endif
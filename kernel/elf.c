@@ -5,7 +5,11 @@
 
 #include "elf.h"
 #include "string.h"
+#include "util/string.h"
 #include "riscv.h"
+#include "vmm.h"
+#include "slab.h"
+#include "util/functions.h"
 #include "spike_interface/spike_utils.h"
 
 typedef struct elf_info_t {
@@ -13,14 +17,6 @@ typedef struct elf_info_t {
   process *p;
 } elf_info;
 
-//
-// the implementation of allocater. allocates memory space for later segment loading
-//
-static void *elf_alloc_mb(elf_ctx *ctx, uint64 elf_pa, uint64 elf_va, uint64 size) {
-  // directly returns the virtual address as we are in the Bare mode in lab1_x
-  return (void *)elf_va;
-}
-
 //
 // actual file reading, using the spike file interface.
 //
@@ -48,43 +44,192 @@ elf_status elf_init(elf_ctx *ctx, void *info) {
 }
 
 //
-// load the elf segments to memory regions as we are in Bare mode in lab1
+// register the elf segments as regions of the user address space. the content of a segment
+// is not read here, but page by page when the application touches it (see user_vm_fault in
+// kernel/vmm.c).
 //
 elf_status elf_load(elf_ctx *ctx) {
-  // elf_prog_header structure is defined in kernel/elf.h
-  elf_prog_header ph_addr;
-  int i, off;
+  // elf_prog_header structure is defined in kernel/elf.h. the program header table is
+  // fetched from the host in as few reads as possible.
+  elf_prog_header ph_table[ELF_MAX_PROG_HEADERS];
+  process *p = ((elf_info *)ctx->info)->p;
+  uint16 i, n;
+
+  if (ctx->ehdr.phentsize != sizeof(elf_prog_header)) return EL_ERR;
+
+  for (i = 0; i < ctx->ehdr.phnum; i += n) {
+    n = MIN(ctx->ehdr.phnum - i, ELF_MAX_PROG_HEADERS);
+    uint64 nb = n * sizeof(elf_prog_header);
+    if (elf_fpread(ctx, ph_table, nb, ctx->ehdr.phoff + i * sizeof(elf_prog_header)) != nb)
+      return EL_EIO;
 
-  // traverse the elf program segment headers
-  for (i = 0, off = ctx->ehdr.phoff; i < ctx->ehdr.phnum; i++, off += sizeof(ph_addr)) {
-    // read segment headers
-    if (elf_fpread(ctx, (void *)&ph_addr, sizeof(ph_addr), off) != sizeof(ph_addr)) return EL_EIO;
+    for (elf_prog_header *ph = ph_table; ph < ph_table + n; ph++) {
+      if (ph->type != ELF_PROG_LOAD) continue;
+      if (ph->memsz < ph->filesz) return EL_ERR;
+      if (ph->vaddr + ph->memsz < ph->vaddr) return EL_ERR;
+
+      // only the first filesz bytes of a segment exist in the file, the rest (i.e., .bss)
+      // is zero-filled in guest memory.
+      int prot = ((ph->flags & ELF_PF_R) ? PROT_READ : 0) |
+                 ((ph->flags & ELF_PF_W) ? PROT_WRITE : 0) |
+                 ((ph->flags & ELF_PF_X) ? PROT_EXEC : 0);
+      if (user_vm_add_region(p, ph->vaddr, ph->memsz, ph->filesz, ph->off, prot) != 0)
+        return EL_ENOMEM;
+      // the heap (SYS_sbrk) starts right above the highest segment
+      p->heap_base = MAX(p->heap_base, ROUNDUP(ph->vaddr + ph->memsz, PGSIZE));
+
+      log_info("Segment 0x%lx: %ld bytes in file, %ld bytes zero-filled, loaded on demand.\n",
+             ph->vaddr, ph->filesz, ph->memsz - ph->filesz);
+    }
+  }
 
-    if (ph_addr.type != ELF_PROG_LOAD) continue;
-    if (ph_addr.memsz < ph_addr.filesz) return EL_ERR;
-    if (ph_addr.vaddr + ph_addr.memsz < ph_addr.vaddr) return EL_ERR;
+  return EL_OK;
+}
 
-    // allocate memory block before elf loading
-    void *dest = elf_alloc_mb(ctx, ph_addr.vaddr, ph_addr.vaddr, ph_addr.memsz);
+//
+// heap sort the symbol index by start address, so that lookups can use binary search.
+//
+static void sift_down(elf_sym_entry *e, uint32 root, uint32 n) {
+  while (2 * root + 1 < n) {
+    uint32 child = 2 * root + 1;
+    if (child + 1 < n && e[child + 1].start > e[child].start) child++;
+    if (e[root].start >= e[child].start) return;
+    elf_sym_entry tmp = e[root];
+    e[root] = e[child];
+    e[child] = tmp;
+    root = child;
+  }
+}
 
-    // actual loading
-    if (elf_fpread(ctx, dest, ph_addr.memsz, ph_addr.off) != ph_addr.memsz)
+static void sort_symbols(elf_sym_entry *e, uint32 n) {
+  for (uint32 i = n / 2; i-- > 0;) sift_down(e, i, n);
+  for (uint32 i = n; i-- > 1;) {
+    elf_sym_entry tmp = e[0];
+    e[0] = e[i];
+    e[i] = tmp;
+    sift_down(e, 0, i);
+  }
+}
+
+//
+// build the symbol index of elf_load_symbols(), with the scratch buffers it has allocated.
+//
+static elf_status build_symtab(elf_ctx *ctx, elf_symtab *symtab, elf_section_header *sh_table,
+                               elf_symbol *sym_batch) {
+  elf_header *ehdr = &ctx->ehdr;
+  elf_section_header symtab_sh, strtab_sh;
+  uint16 i, n;
+
+  symtab->count = 0;
+  if (ehdr->shentsize != sizeof(elf_section_header)) return EL_ERR;
+
+  // fetch the section header table, and look for the symbol table.
+  symtab_sh.size = 0;
+  for (i = 0; i < ehdr->shnum && !symtab_sh.size; i += n) {
+    n = MIN(ehdr->shnum - i, ELF_MAX_SECTIONS);
+    uint64 nb = n * sizeof(elf_section_header);
+    if (elf_fpread(ctx, sh_table, nb, ehdr->shoff + i * sizeof(elf_section_header)) != nb)
+      return EL_EIO;
+
+    for (uint16 k = 0; k < n; k++)
+      if (sh_table[k].type == ELF_SHT_SYMTAB) {
+        symtab_sh = sh_table[k];
+        break;
+      }
+  }
+  if (!symtab_sh.size || symtab_sh.entsize != sizeof(elf_symbol) || symtab_sh.link >= ehdr->shnum)
+    return EL_OK;  // stripped elf, nothing to index
+
+  // the string table of the symbols is the section linked by the symbol table.
+  if (elf_fpread(ctx, &strtab_sh, sizeof(strtab_sh),
+                 ehdr->shoff + symtab_sh.link * sizeof(elf_section_header)) != sizeof(strtab_sh))
+    return EL_EIO;
+  if (!strtab_sh.size) return EL_OK;
+
+  // take no more entries than there are symbols. kmalloc() is defined in kernel/slab.c
+  uint64 nsyms = symtab_sh.size / sizeof(elf_symbol);
+  symtab->strtab = kmalloc(strtab_sh.size);
+  symtab->entries = kmalloc(sizeof(elf_sym_entry) * MIN(nsyms, MAX_SYMBOLS));
+  if (!symtab->strtab || !symtab->entries) return EL_ENOMEM;
+  symtab->strtab_size = strtab_sh.size;
+  if (elf_fpread(ctx, symtab->strtab, strtab_sh.size, strtab_sh.offset) != strtab_sh.size)
+    return EL_EIO;
+
+  for (uint64 j = 0, m; j < nsyms; j += m) {
+    m = MIN(nsyms - j, ELF_SYMBOL_BATCH);
+    uint64 nb = m * sizeof(elf_symbol);
+    if (elf_fpread(ctx, sym_batch, nb, symtab_sh.offset + j * sizeof(elf_symbol)) != nb)
       return EL_EIO;
+
+    for (elf_symbol *sym = sym_batch; sym < sym_batch + m; sym++) {
+      if (ELF_SYM_TYPE(sym->info) != STT_FUNC || !sym->size || sym->name >= strtab_sh.size)
+        continue;
+      if (symtab->count == MAX_SYMBOLS) {
+        log_warn("elf: more than %d function symbols, the rest are not indexed.\n", MAX_SYMBOLS);
+        goto done;
+      }
+      elf_sym_entry *e = &symtab->entries[symtab->count++];
+      e->start = sym->value;
+      e->size = sym->size;
+      e->name = sym->name;
+    }
   }
 
+done:
+  sort_symbols(symtab->entries, symtab->count);
   return EL_OK;
 }
 
-typedef union {
-  uint64 buf[MAX_CMDLINE_ARGS];
-  char *argv[MAX_CMDLINE_ARGS];
-} arg_buf;
+//
+// read .symtab and .strtab of the elf once, and build an address-sorted index of the
+// function symbols in (guest) memory. later lookups need no HTIF traffic.
+//
+elf_status elf_load_symbols(elf_ctx *ctx, elf_symtab *symtab) {
+  // the scratch buffers are too large for the kernel stack.
+  elf_section_header *sh_table = kmalloc(sizeof(elf_section_header) * ELF_MAX_SECTIONS);
+  elf_symbol *sym_batch = kmalloc(sizeof(elf_symbol) * ELF_SYMBOL_BATCH);
+
+  elf_status ret = EL_ENOMEM;
+  if (sh_table && sym_batch) ret = build_symtab(ctx, symtab, sh_table, sym_batch);
+  kfree(sh_table);
+  kfree(sym_batch);
+
+  // keep no partial index.
+  if (ret != EL_OK) {
+    kfree(symtab->strtab);
+    kfree(symtab->entries);
+    symtab->strtab = NULL;
+    symtab->entries = NULL;
+    symtab->count = 0;
+  }
+  return ret;
+}
+
+//
+// find the symbol containing addr in a symbol index by binary search.
+//
+const char *elf_symtab_lookup(elf_symtab *symtab, uint64 addr) {
+  // find the last entry whose start address is not larger than addr
+  uint32 lo = 0, hi = symtab->count;
+  while (lo < hi) {
+    uint32 mid = lo + (hi - lo) / 2;
+    if (symtab->entries[mid].start <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0) return NULL;
+
+  elf_sym_entry *e = &symtab->entries[lo - 1];
+  if (addr >= e->start + e->size) return NULL;
+  return symtab->strtab + e->name;
+}
 
 //
-// returns the number (should be 1) of string(s) after PKE kernel in command line.
-// and store the string(s) in arg_bug_msg.
+// returns the number of string(s) after PKE kernel in command line, i.e., the applications to
+// run, and store the string(s) in arg_bug_msg.
 //
-static size_t parse_args(arg_buf *arg_bug_msg) {
+size_t parse_args(arg_buf *arg_bug_msg) {
   // HTIFSYS_getmainvars frontend call reads command arguments to (input) *arg_bug_msg
   long r = frontend_syscall(HTIFSYS_getmainvars, (uint64)arg_bug_msg,
       sizeof(*arg_bug_msg), 0, 0, 0, 0, 0);
@@ -101,27 +246,34 @@ static size_t parse_args(arg_buf *arg_bug_msg) {
   return pk_argc - arg;
 }
 
-//added in lab1_challenge1
-elf_ctx elf_loader;
+// symbol indexes of the processes. added @lab1_challenge1
+static kmem_cache *symtab_cache;
+
+static void symtab_ctor(void *obj) { memset(obj, 0, sizeof(elf_symtab)); }
 
 //
-// load the elf of user application, by using the spike file interface.
+// create the cache of symbol indexes. called once by s_start() (kernel/kernel.c), before any
+// hart loads an application.
 //
-void load_bincode_from_host_elf(process *p) {
-  arg_buf arg_bug_msg;
-
-  // retrieve command line arguements
-  size_t argc = parse_args(&arg_bug_msg);
-  if (!argc) panic("You need to specify the application program!\n");
+void elf_symtab_init(void) {
+  symtab_cache = kmem_cache_create("elf_symtab", sizeof(elf_symtab), symtab_ctor);
+  if (!symtab_cache) panic("elf_symtab_init: fail to create the cache of symbol tables.\n");
+}
 
-  sprint("Application: %s\n", arg_bug_msg.argv[0]);
+//
+// load the elf of a user application (at host path "filename") into process p, by using the
+// spike file interface.
+//
+void load_bincode_from_host_elf(process *p, const char *filename) {
+  log_info("Application: %s\n", filename);
+  safestrcpy(p->name, filename, PROC_NAME_LEN);
 
   //elf loading. elf_ctx is defined in kernel/elf.h, used to track the loading process.
   elf_ctx elfloader;
   // elf_info is defined above, used to tie the elf file and its corresponding process.
   elf_info info;
 
-  info.f = spike_file_open(arg_bug_msg.argv[0], O_RDONLY, 0);
+  info.f = spike_file_open(filename, O_RDONLY, 0);
   info.p = p;
   // IS_ERR_VALUE is a macro defined in spike_interface/spike_htif.h
   if (IS_ERR_VALUE(info.f)) panic("Fail on openning the input application program.\n");
@@ -133,86 +285,28 @@ void load_bincode_from_host_elf(process *p) {
   // load elf. elf_load() is defined above.
   if (elf_load(&elfloader) != EL_OK) panic("Fail on loading elf.\n");
 
-  // entry (virtual, also physical in lab1_x) address
+  // build the symbol index while the file is still open. elf_load_symbols() is defined above.
+  // an application without symbols still runs, its backtraces are just not symbolized.
+  if (!(p->symtab = kmem_cache_alloc(symtab_cache)))
+    panic("Fail on allocating the symbol table of elf.\n");
+  elf_status ret = elf_load_symbols(&elfloader, p->symtab);
+  if (ret == EL_ENOMEM) {
+    log_warn("elf: no memory for the symbols of %s.\n", filename);
+  } else if (ret != EL_OK) {
+    panic("Fail on loading the symbol table of elf.\n");
+  }
+
+  // entry (virtual) address
   p->trapframe->epc = elfloader.ehdr.entry;
-  //added in lab1_challenge1
-  elf_loader = elfloader;
-  //memcpy(&elf_loader, &elfloader, sizeof(elf_ctx));
-  // close the host spike file
-  spike_file_close( info.f );
 
-  sprint("Application program entry point (virtual address): 0x%lx\n", p->trapframe->epc);
+  // the host file stays open, as the pages of the application are loaded on demand.
+  p->elf_file = info.f;
+
+  log_info("Application program entry point (virtual address): 0x%lx\n", p->trapframe->epc);
 }
 
-//added in lab1_challenge1
-void find_functionName(void* ip) {
-  elf_header ehdr = elf_loader.ehdr;
-  uint16 shstrndx = ehdr.shstrndx;
-  uint64 shoff = ehdr.shoff;
-  uint16 shentsize = ehdr.shentsize;
-  uint16 shnum = ehdr.shnum;
-
-  uint64 shstraddr = shoff + (uint64)shstrndx * shentsize;
-  uint64 shstrtab_offset ;//= *((uint64*)(shstraddr + 24));
-  uint64 shstrtab_size ;//= *((uint64*)(shstraddr + 32));
-  elf_fpread(&elf_loader, &shstrtab_offset, 8, shstraddr + 24);
-  elf_fpread(&elf_loader, &shstrtab_size, 8, shstraddr + 32);
-  
-  char shstrTableBuf[shstrtab_size];
-  //char *strTableBuf; //we implement malloc in lab2_2
-  // strTableBuf = (char *)malloc(strtab_size * sizeof(char));
-  // if (strTableBuf == NULL) {
-  //   panic("strTableBuf Memory allocation failed.\n");
-  // } 
-  elf_fpread(&elf_loader, shstrTableBuf, shstrtab_size, shstrtab_offset);
-
-  uint64 strtab_offset;
-  uint64 strtab_size;
-  for(uint16 i = 0;i < shnum;++ i) {
-    uint64 sectionP = (shoff + (uint64)i * shentsize);
-    uint32 sh_name ;//= *((uint32*)sectionP);
-    elf_fpread(&elf_loader, &sh_name, 4, sectionP);
-    char* sh_name_str = (char*)((uint64)shstrTableBuf + (uint64)sh_name);
-
-    if (strcmp(sh_name_str, ".strtab") == 0) {
-      elf_fpread(&elf_loader, &strtab_offset, 8, sectionP + 24);
-      elf_fpread(&elf_loader, &strtab_size, 8, sectionP + 32);
-    }
-  }
-  char strTableBuf[strtab_size];
-  elf_fpread(&elf_loader, strTableBuf, strtab_size, strtab_offset);
-
-  for(uint16 i = 0;i < shnum;++ i) {
-    uint64 sectionP = (shoff + (uint64)i * shentsize);
-    uint32 sh_name ;//= *((uint32*)sectionP);
-    elf_fpread(&elf_loader, &sh_name, 4, sectionP);
-    char* sh_name_str = (char*)((uint64)shstrTableBuf + (uint64)sh_name);
-    
-    if (strcmp(sh_name_str, ".symtab") == 0) {
-      uint64 syboff ;//= *((uint64*)(sectionP + 24));
-      uint64 syb_size ;//= *((uint64*)(sectionP + 32));
-      uint64 syb_entsize ;//= *((uint64*)(sectionP + 56));
-      elf_fpread(&elf_loader, &syboff, 8, sectionP + 24);
-      elf_fpread(&elf_loader, &syb_size, 8, sectionP + 32);
-      elf_fpread(&elf_loader, &syb_entsize, 8, sectionP + 56);
-
-      for(uint64 j = 0;j * syb_entsize < syb_size;++ j) {
-        uint64 syb_entaddr = syboff + j * syb_entsize;
-        uint32 st_name ;//= *((uint63*)(syb_entaddr));
-        uint64 st_value ;//= *((uint64*)(syb_entaddr + 8));
-        uint64 st_size ;//= *((uint64*)(syb_entaddr + 16));
-        elf_fpread(&elf_loader, &st_name, 4, syb_entaddr);
-        elf_fpread(&elf_loader, &st_value, 8, syb_entaddr + 8);
-        elf_fpread(&elf_loader, &st_size, 8, syb_entaddr + 16);
-        // sprint("%lld %lld %lld\n", j, syb_entsize, syb_size);
-        if ((uint64)ip >= st_value && (uint64)ip < st_value + st_size) {
-          sprint("%s\n",(char*)((uint64)strTableBuf + (uint64)st_name));
-          //free(strTableBuf);
-          //(strtab_offset + (uint64)*((uint32*)syb_entaddr))
-        }
-      }
-      //break;
-    }
-  }  
-  //free(strTableBuf);
-}
\ No newline at end of file
+//
+// returns the name of the user function (of the current process) containing ip.
+// added @lab1_challenge1
+//
+const char *find_functionName(uint64 ip) { return elf_symtab_lookup(current->symtab, ip); }
@@ -37,8 +37,36 @@ typedef struct elf_prog_header_t {
   uint64 align;  /* Segment alignment */
 } elf_prog_header;
 
+// Section header.
+typedef struct elf_section_header_t {
+  uint32 name;      /* Section name (string table index) */
+  uint32 type;      /* Section type */
+  uint64 flags;     /* Section flags */
+  uint64 addr;      /* Section virtual address at execution */
+  uint64 offset;    /* Section file offset */
+  uint64 size;      /* Section size in bytes */
+  uint32 link;      /* Link to another section */
+  uint32 info;      /* Additional section information */
+  uint64 addralign; /* Section alignment */
+  uint64 entsize;   /* Entry size if section holds table */
+} elf_section_header;
+
+// Symbol table entry.
+typedef struct elf_symbol_t {
+  uint32 name;   /* Symbol name (string table index) */
+  uint8 info;    /* Symbol type and binding */
+  uint8 other;   /* Symbol visibility */
+  uint16 shndx;  /* Section index */
+  uint64 value;  /* Symbol value */
+  uint64 size;   /* Symbol size */
+} elf_symbol;
+
 #define ELF_MAGIC 0x464C457FU  // "\x7FELF" in little endian
 #define ELF_PROG_LOAD 1
+#define ELF_PF_X 1  // segment is executable
+#define ELF_PF_W 2  // segment is writable
+#define ELF_PF_R 4  // segment is readable
+#define ELF_SHT_SYMTAB 2
 
 typedef enum elf_status_t {
   EL_OK = 0,
@@ -55,14 +83,49 @@ typedef struct elf_ctx_t {
   elf_header ehdr;
 } elf_ctx;
 
+#define ELF_SYM_TYPE(info) ((info) & 0xf)
+#define STT_FUNC 2
+
+// number of headers (or symbols) fetched from the host by one read while scanning the elf
+#define ELF_MAX_PROG_HEADERS 16
+#define ELF_MAX_SECTIONS 64
+#define ELF_SYMBOL_BATCH 256
+
+// capacity of the in-memory symbol index built when loading the application. added @lab1_challenge1
+#define MAX_SYMBOLS 1024
+
+// one (function) symbol of the index. entries are kept sorted by their start address.
+typedef struct elf_sym_entry_t {
+  uint64 start;  /* Start address of the function */
+  uint64 size;   /* Size of the function in bytes */
+  uint32 name;   /* Offset of the name in the symbol string table */
+} elf_sym_entry;
+
+// the symbol index of a loaded elf, used to symbolize addresses without accessing the host.
+typedef struct elf_symtab_t {
+  elf_sym_entry *entries;
+  uint32 count;
+  char *strtab;
+  uint64 strtab_size;
+} elf_symtab;
+
 elf_status elf_init(elf_ctx *ctx, void *info);
 elf_status elf_load(elf_ctx *ctx);
+elf_status elf_load_symbols(elf_ctx *ctx, elf_symtab *symtab);
+
+const char *elf_symtab_lookup(elf_symtab *symtab, uint64 addr);
+
+// the command line arguments, filled by HTIFSYS_getmainvars
+typedef union {
+  uint64 buf[MAX_CMDLINE_ARGS];
+  char *argv[MAX_CMDLINE_ARGS];
+} arg_buf;
 
-void load_bincode_from_host_elf(process *p);
+size_t parse_args(arg_buf *arg_bug_msg);
+void elf_symtab_init(void);
+void load_bincode_from_host_elf(process *p, const char *filename);
 
-//added in lab1_challenge1
-// extern elf_ctx elf_loader;
-// uint64 elf_fpread(elf_ctx *ctx, void *dest, uint64 nb, uint64 offset);
-void find_functionName(void* ip);
+// returns the name of the function containing ip, or NULL if ip is not in any known function.
+const char *find_functionName(uint64 ip);
 
 #endif
@@ -3,49 +3,107 @@
  */
 
 #include "riscv.h"
+#include "config.h"
 #include "string.h"
 #include "elf.h"
 #include "process.h"
+#include "pmm.h"
+#include "slab.h"
+#include "vmm.h"
+#include "strap.h"
+#include "sched.h"
+
+#include "vdso.h"
 
 #include "spike_interface/spike_utils.h"
 
-// process is a structure defined in kernel/process.h
-process user_app;
+//
+// load the applications given in the command line, one process for each, and spread them
+// over the run queues of the harts. load_bincode_from_host_elf is defined in elf.c
+//
+static void load_user_programs(void) {
+  arg_buf args;
+  size_t argc = parse_args(&args);
+  if (!argc) panic("You need to specify the application program!\n");
+
+  for (size_t i = 0; i < argc; i++) {
+    // alloc_process() is defined in kernel/process.c
+    process *proc = alloc_process();
+    if (!proc) {
+      log_warn("process table is full, %s and the rest are not run.\n", args.argv[i]);
+      break;
+    }
+    load_bincode_from_host_elf(proc, args.argv[i]);
+    // insert_to_ready_queue() is defined in kernel/sched.c
+    insert_to_ready_queue(proc, i % g_num_harts);
+  }
+}
+
+//
+// release the other harts parked in m_start() (kernel/machine/minit.c), by raising their
+// machine software interrupts. they enter S-mode at s_start_hart() below.
+//
+static void release_harts(void) {
+  for (uint64 hartid = 0; hartid < g_num_harts; hartid++)
+    if (hartid != read_tp()) *(volatile uint32 *)CLINT_MSIP(hartid) = 1;
+}
 
 //
-// load the elf, and construct a "process" (with only a trapframe).
-// load_bincode_from_host_elf is defined in elf.c
+// s_start_hart: S-mode entry point of the harts other than hart 0. they share the kernel page
+// table built by hart 0, and run (or steal) the processes of the run queues.
 //
-void load_user_program(process *proc) {
-  // USER_TRAP_FRAME is a physical address defined in kernel/config.h
-  proc->trapframe = (trapframe *)USER_TRAP_FRAME;
-  memset(proc->trapframe, 0, sizeof(trapframe));
-  // USER_KSTACK is also a physical address defined in kernel/config.h
-  proc->kstack = USER_KSTACK;
-  proc->trapframe->regs.sp = USER_STACK;
+void s_start_hart(void) {
+  write_csr(satp, MAKE_SATP(g_kernel_pagetable));
+  flush_tlb();
+  write_csr(scounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR | COUNTEREN_HPM);
+  log_info("hart %ld: enter supervisor mode\n", read_tp());
 
-  // load_bincode_from_host_elf() is defined in kernel/elf.c
-  load_bincode_from_host_elf(proc);
+  // schedule() is defined in kernel/sched.c, it idles the hart until there is a process.
+  schedule();
 }
 
 //
 // s_start: S-mode entry point of riscv-pke OS kernel.
 //
 int s_start(void) {
-  sprint("Enter supervisor mode...\n");
-  // Note: we use direct (i.e., Bare mode) for memory mapping in lab1.
-  // which means: Virtual Address = Physical Address
-  // therefore, we need to set satp to be 0 for now. we will enable paging in lab2_x.
-  // 
-  // write_csr is a macro defined in kernel/riscv.h
+  log_info("Enter supervisor mode...\n");
+  // in the beginning, we use Bare mode (direct) memory mapping as in lab1.
+  // but now, we are going to switch to the paging mode @lab2_1.
+  // note, the code still works in Bare mode when calling pmm_init() and kern_vm_init().
   write_csr(satp, 0);
 
-  // the application code (elf) is first loaded into memory, and then put into execution
-  load_user_program(&user_app);
+  // init phisical memory manager. pmm_init() is defined in kernel/pmm.c
+  pmm_init();
+
+  // build the kernel page table. kern_vm_init() is defined in kernel/vmm.c
+  kern_vm_init();
+
+  // set up the caches of kmalloc(). slab_init() is defined in kernel/slab.c
+  slab_init();
+  // and the cache of the symbol indexes of applications. defined in kernel/elf.c
+  elf_symtab_init();
+
+  // allocate the time page shared with user space. vdso_init() is defined in kernel/vdso.c
+  vdso_init();
+
+  // now, switch to paging mode by turning on paging (SV39)
+  write_csr(satp, MAKE_SATP(g_kernel_pagetable));
+  flush_tlb();
+  log_info("Enable paging mode!\n");
+
+  // let user applications read cycle/time/instret as well, e.g., to time their syscalls.
+  // mcounteren has been set up in m_start() (kernel/machine/minit.c).
+  write_csr(scounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR | COUNTEREN_HPM);
+
+  // the kernel page table is ready, let the other harts in.
+  release_harts();
+
+  // the application codes (elf) are first loaded into memory, and then put into execution
+  load_user_programs();
 
-  sprint("Switch to user mode...\n");
-  // switch_to() is defined in kernel/process.c
-  switch_to(&user_app);
+  log_info("Switch to user mode...\n");
+  // schedule() is defined in kernel/sched.c, it picks a process and switches to it.
+  schedule();
 
   // we should never reach here.
   return 0;
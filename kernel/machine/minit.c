@@ -10,15 +10,21 @@
 //
 // global variables are placed in the .data section.
 // stack0 is the privilege mode stack(s) of the proxy kernel on CPU(s)
-// allocates 4KB stack space for each processor (hart)
+// allocates 4KB stack space for each processor (hart), used by m_start() and then by the
+// S-mode boot code of the hart.
 //
-// NCPU is defined to be 1 in kernel/config.h, as we consider only one HART in basic
-// labs.
+// NCPU (defined in kernel/config.h) is the maximum number of HARTs we support. harts whose
+// ids are beyond it are parked forever by _mentry (kernel/machine/mentry.S).
 //
 __attribute__((aligned(16))) char stack0[4096 * NCPU];
+// mstack is the stack of each hart when handling M-mode traps (kernel/machine/mtrap_vector.S).
+// it is separated from stack0, as the timer may interrupt the S-mode code running on stack0.
+__attribute__((aligned(16))) char mstack[4096 * NCPU];
 
 // sstart() is the supervisor state entry point defined in kernel/kernel.c
 extern void s_start();
+// supervisor state entry point of the other harts, defined in kernel/kernel.c
+extern void s_start_hart();
 // M-mode trap entry point, added @lab1_2
 extern void mtrapvec();
 
@@ -27,8 +33,9 @@ extern uint64 htif;
 // g_mem_size is defined in spike_interface/spike_memory.c, size of the emulated memory
 extern uint64 g_mem_size;
 // struct riscv_regs is define in kernel/riscv.h, and g_itrframe is used to save
-// registers when interrupt hapens in M mode. added @lab1_2
-riscv_regs g_itrframe;
+// registers when interrupt hapens in M mode. added @lab1_2. one frame per hart, pointed by
+// its mscratch.
+riscv_regs g_itrframe[NCPU];
 
 //
 // get the information of HTIF (calling interface) and the emulated memory by
@@ -41,11 +48,20 @@ riscv_regs g_itrframe;
 void init_dtb(uint64 dtb) {
   // defined in spike_interface/spike_htif.c, enabling Host-Target InterFace (HTIF)
   query_htif(dtb);
-  if (htif) sprint("HTIF is available!\r\n");
+  if (htif) log_info("HTIF is available!\r\n");
 
   // defined in spike_interface/spike_memory.c, obtain information about emulated memory
   query_mem(dtb);
-  sprint("(Emulated) memory size: %ld MB\n", g_mem_size >> 20);
+  log_info("(Emulated) memory size: %ld MB\n", g_mem_size >> 20);
+
+  // defined in spike_interface/spike_hart.c, obtain the number of harts and the timebase
+  query_harts(dtb);
+  if (g_num_harts > NCPU) {
+    log_info("%ld harts found, only %d of them are used\n", g_num_harts, NCPU);
+    g_num_harts = NCPU;
+  }
+  log_info("Harts: %ld, timebase: %ld Hz, Sstc: %s\n", g_num_harts, g_timebase,
+           g_sstc ? "yes" : "no");
 }
 
 //
@@ -56,7 +72,7 @@ static void delegate_traps() {
   // supports_extension macro is defined in kernel/riscv.h
   if (!supports_extension('S')) {
     // confirm that our processor supports supervisor mode. abort if it does not.
-    sprint("S mode is not supported.\n");
+    log_error("S mode is not supported.\n");
     return;
   }
 
@@ -80,43 +96,62 @@ static void delegate_traps() {
 // enabling timer interrupt (irq) in Machine mode. added @lab1_3
 //
 void timerinit(uintptr_t hartid) {
-  // fire timer irq after TIMER_INTERVAL from now.
-  *(uint64*)CLINT_MTIMECMP(hartid) = *(uint64*)CLINT_MTIME + TIMER_INTERVAL;
+  // the timer is stopped until S-mode sets a deadline (SBI_SET_TIMER, see kernel/sbi.h).
+  *(uint64*)CLINT_MTIMECMP(hartid) = -1ULL;
+
+  // with Sstc, S-mode programs its own timer (stimecmp) and takes the timer interrupts
+  // directly, M-mode is not involved. menvcfg is CSR 0x30a.
+  if (g_sstc) {
+    asm volatile("csrs 0x30a, %0" ::"r"(MENVCFG_STCE));
+    write_stimecmp(-1ULL);
+  }
+
+  // enable machine-mode timer irq, and the software irq used as IPI, in MIE (Machine
+  // Interrupt Enable) csr.
+  write_csr(mie, read_csr(mie) | MIE_MTIE | MIE_MSIE);
+}
 
-  // enable machine-mode timer irq in MIE (Machine Interrupt Enable) csr.
-  write_csr(mie, read_csr(mie) | MIE_MTIE);
+//
+// park a hart other than hart 0 until the kernel releases it, by raising its machine software
+// interrupt (CLINT msip, see release_harts() in kernel/kernel.c). the interrupt is only used
+// to wake up the hart from wfi, it is not taken as mstatus.MIE is still clear.
+//
+static void park_hart(uintptr_t hartid) {
+  write_csr(mie, read_csr(mie) | MIE_MSIE);
+  while (!(read_csr(mip) & MIP_MSIP)) asm volatile("wfi");
+
+  *(volatile uint32*)CLINT_MSIP(hartid) = 0;
 }
 
 //
 // m_start: machine mode C entry point.
 //
 void m_start(uintptr_t hartid, uintptr_t dtb) {
-  // init the spike file interface (stdin,stdout,stderr)
-  // functions with "spike_" prefix are all defined in codes under spike_interface/,
-  // sprint is also defined in spike_interface/spike_utils.c
-  spike_file_init();
-  sprint("In m_start, hartid:%d\n", hartid);
-
-  // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
-  // init_dtb() is defined above.
-  init_dtb(dtb);
+  if (hartid == 0) {
+    // init the spike file interface (stdin,stdout,stderr)
+    // functions with "spike_" prefix are all defined in codes under spike_interface/,
+    // sprint and log_* are also defined in spike_interface/spike_utils.c
+    spike_file_init();
+    log_info("In m_start, hartid:%d\n", hartid);
+
+    // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
+    // init_dtb() is defined above.
+    init_dtb(dtb);
+  }
 
   // save the address of trap frame for interrupt in M mode to "mscratch". added @lab1_2
-  write_csr(mscratch, &g_itrframe);
+  write_csr(mscratch, &g_itrframe[hartid]);
 
   // set previous privilege mode to S (Supervisor), and will enter S mode after 'mret'
   // write_csr is a macro defined in kernel/riscv.h
   write_csr(mstatus, ((read_csr(mstatus) & ~MSTATUS_MPP_MASK) | MSTATUS_MPP_S));
 
   // set M Exception Program Counter to sstart, for mret (requires gcc -mcmodel=medany)
-  write_csr(mepc, (uint64)s_start);
+  write_csr(mepc, hartid == 0 ? (uint64)s_start : (uint64)s_start_hart);
 
   // setup trap handling vector for machine mode. added @lab1_2
   write_csr(mtvec, (uint64)mtrapvec);
 
-  // enable machine-mode interrupts. added @lab1_3
-  write_csr(mstatus, read_csr(mstatus) | MSTATUS_MIE);
-
   // delegate all interrupts and exceptions to supervisor mode.
   // delegate_traps() is defined above.
   delegate_traps();
@@ -124,6 +159,19 @@ void m_start(uintptr_t hartid, uintptr_t dtb) {
   // also enables interrupt handling in supervisor mode. added @lab1_3
   write_csr(sie, read_csr(sie) | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
+  // allow S-mode to read the cycle, time, instret and hpm counters (e.g., for syscall
+  // statistics), and to delegate them to U-mode by scounteren.
+  write_csr(mcounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR | COUNTEREN_HPM);
+
+  // the other harts wait until hart 0 has set up the kernel (e.g., its page table).
+  if (hartid != 0) park_hart(hartid);
+
+  // keep the hartid in tp, as S-mode cannot read mhartid. see mycpu() in kernel/process.h
+  write_tp(hartid);
+
+  // enable machine-mode interrupts. added @lab1_3
+  write_csr(mstatus, read_csr(mstatus) | MSTATUS_MIE);
+
   // init timing. added @lab1_3
   timerinit(hartid);
 
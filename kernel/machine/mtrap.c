@@ -1,5 +1,7 @@
 #include "kernel/riscv.h"
 #include "kernel/process.h"
+#include "kernel/sbi.h"
+#include "kernel/perf.h"
 #include "spike_interface/spike_utils.h"
 
 static void handle_instruction_access_fault() { panic("Instruction access fault!"); }
@@ -14,16 +16,62 @@ static void handle_misaligned_load() { panic("Misaligned Load!"); }
 
 static void handle_misaligned_store() { panic("Misaligned AMO!"); }
 
-// added @lab1_3
+// added @lab1_3. the timer is one-shot: S-mode programs the next deadline (if any) through
+// SBI_SET_TIMER, after handling the expired timers (see timer_run() in kernel/timer.c).
 static void handle_timer() {
-  int cpuid = 0;
-  // setup the timer fired at next time (TIMER_INTERVAL from now)
-  *(uint64*)CLINT_MTIMECMP(cpuid) = *(uint64*)CLINT_MTIMECMP(cpuid) + TIMER_INTERVAL;
+  int cpuid = read_csr(mhartid);
+  // stop the timer until the next deadline is set
+  *(uint64*)CLINT_MTIMECMP(cpuid) = -1ULL;
 
   // setup a soft interrupt in sip (S-mode Interrupt Pending) to be handled in S-mode
   write_csr(sip, SIP_SSIP);
 }
 
+// an IPI (inter-processor interrupt) raised through CLINT msip by another hart, e.g., to wake
+// up an idle hart when there are processes to run. it is relayed to S-mode like the timer.
+static void handle_soft_irq() {
+  int cpuid = read_csr(mhartid);
+  *(volatile uint32*)CLINT_MSIP(cpuid) = 0;
+  write_csr(sip, SIP_SSIP);
+}
+
+// select the event of an hpmcounter, and set its count. the csrs are named by immediates,
+// hence the switch over the counters of kernel/perf.h.
+static uint64 perf_config(uint64 counter, uint64 event, uint64 value) {
+  switch (counter) {
+#define PERF_CONFIG_HPM(i)            \
+  case i:                             \
+    write_csr(mhpmevent##i, event);   \
+    write_csr(mhpmcounter##i, value); \
+    return 0;
+    PERF_HPM_COUNTERS(PERF_CONFIG_HPM)
+#undef PERF_CONFIG_HPM
+  }
+  return -1;
+}
+
+// ecall from S-mode, see kernel/sbi.h. the registers of S-mode are saved in the frame pointed
+// by mscratch.
+static void handle_sbi_call() {
+  riscv_regs* regs = (riscv_regs*)read_csr(mscratch);
+  int cpuid = read_csr(mhartid);
+
+  switch (regs->a7) {
+    case SBI_SET_TIMER:
+      *(uint64*)CLINT_MTIMECMP(cpuid) = regs->a0;
+      regs->a0 = 0;
+      break;
+    case SBI_PERF_CONFIG:
+      regs->a0 = perf_config(regs->a0, regs->a1, regs->a2);
+      break;
+    default:
+      regs->a0 = -1;
+      break;
+  }
+  // return to the instruction after ecall
+  write_csr(mepc, read_csr(mepc) + 4);
+}
+
 //
 // handle_mtrap calls a handling function according to the type of a machine mode interrupt (trap).
 //
@@ -33,6 +81,12 @@ void handle_mtrap() {
     case CAUSE_MTIMER:
       handle_timer();
       break;
+    case CAUSE_MSOFT:
+      handle_soft_irq();
+      break;
+    case CAUSE_SUPERVISOR_ECALL:
+      handle_sbi_call();
+      break;
     case CAUSE_FETCH_ACCESS:
       handle_instruction_access_fault();
       break;
@@ -56,8 +110,8 @@ void handle_mtrap() {
       break;
 
     default:
-      sprint("machine trap(): unexpected mscause %p\n", mcause);
-      sprint("            mepc=%p mtval=%p\n", read_csr(mepc), read_csr(mtval));
+      log_error("machine trap(): unexpected mscause %p\n", mcause);
+      log_error("            mepc=%p mtval=%p\n", read_csr(mepc), read_csr(mtval));
       panic( "unexpected exception happened in M-mode.\n" );
       break;
   }
@@ -0,0 +1,89 @@
+/*
+ * Kernel side of the performance counters (see kernel/perf.h). The events of a process are
+ * programmed into the hpmcounters of a hart (through M-mode, see SBI_PERF_CONFIG) while it
+ * runs there, and the counts are saved into the process when it leaves the hart.
+ */
+
+#include "perf.h"
+#include "process.h"
+#include "sbi.h"
+#include "spike_interface/spike_utils.h"
+
+// stop the counters of p on the calling hart, keeping their counts in p.
+static void perf_save(process *p) {
+  for (int i = 0; i < PERF_MAX_EVENTS; i++)
+    if (p->perf_used & (1 << i)) {
+      p->perf_count[i] = perf_read_counter(PERF_HPM_BASE + i);
+      sbi_perf_config(PERF_HPM_BASE + i, 0, 0);
+    }
+}
+
+// program the counters of p on the calling hart, resuming from their saved counts.
+static void perf_load(process *p) {
+  for (int i = 0; i < PERF_MAX_EVENTS; i++)
+    if (p->perf_used & (1 << i))
+      sbi_perf_config(PERF_HPM_BASE + i, p->perf_event[i], p->perf_count[i]);
+}
+
+//
+// called by the scheduler (kernel/sched.c) when p leaves the calling hart, before p may be
+// picked up by another hart.
+//
+void perf_switch_out(process *p) {
+  cpu *c = mycpu();
+  if (!p || c->perf_owner != p) return;
+  perf_save(p);
+  c->perf_owner = NULL;
+}
+
+//
+// called by the scheduler right before p runs on the calling hart.
+//
+void perf_switch_in(process *p) {
+  cpu *c = mycpu();
+  if (!p->perf_used || c->perf_owner == p) return;
+  perf_load(p);
+  c->perf_owner = p;
+}
+
+//
+// implement the SYS_perf_event_open syscall: count "event" for current process. returns the
+// counter to read, or -1 if all the counters of the process are in use.
+//
+ssize_t sys_perf_event_open(uint64 event) {
+  if (event == PERF_EVENT_CYCLES) return 0;
+  if (event == PERF_EVENT_INSTRET) return 2;
+  if (event == 0) return -1;
+
+  process *p = current;
+  for (int i = 0; i < PERF_MAX_EVENTS; i++)
+    if (!(p->perf_used & (1 << i))) {
+      p->perf_used |= 1 << i;
+      p->perf_event[i] = event;
+      p->perf_count[i] = 0;
+      if (sbi_perf_config(PERF_HPM_BASE + i, event, 0) != 0) {
+        p->perf_used &= ~(1 << i);
+        return -1;
+      }
+      mycpu()->perf_owner = p;
+      return PERF_HPM_BASE + i;
+    }
+  return -1;
+}
+
+//
+// implement the SYS_perf_event_close syscall: release a counter got by SYS_perf_event_open.
+//
+ssize_t sys_perf_event_close(long counter) {
+  if (counter == 0 || counter == 2) return 0;
+
+  process *p = current;
+  long i = counter - PERF_HPM_BASE;
+  if (i < 0 || i >= PERF_MAX_EVENTS || !(p->perf_used & (1 << i))) return -1;
+
+  p->perf_used &= ~(1 << i);
+  // p runs on this hart, so it owns the counters here.
+  sbi_perf_config(counter, 0, 0);
+  if (!p->perf_used) mycpu()->perf_owner = NULL;
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Hardware performance counters. Applications read the counters directly (cycle, instret and
+ * hpmcounterN are enabled for U-mode by mcounteren and scounteren), and ask the kernel by
+ * SYS_perf_event_open to select the event an hpmcounter counts. The hpmcounters are per
+ * process: the kernel saves and restores them when switching processes. cycle and instret are
+ * free-running counters of the hart. This header is also used by user/user_lib.c.
+ */
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include "util/types.h"
+
+// events of SYS_perf_event_open. the others are raw mhpmevent values, whose meaning is
+// defined by the implementation of the harts.
+#define PERF_EVENT_CYCLES ((uint64)-1)   // counter 0 (cycle)
+#define PERF_EVENT_INSTRET ((uint64)-2)  // counter 2 (instret)
+
+// a process may have PERF_MAX_EVENTS events, counted by hpmcounter3 on.
+#define PERF_HPM_BASE 3
+#define PERF_MAX_EVENTS 8
+#define PERF_HPM_COUNTERS(X) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10)
+
+// read counter n (0: cycle, 2: instret, PERF_HPM_BASE...: hpmcounterN) from S-mode or U-mode.
+// returns 0 for the other counters.
+static inline uint64 perf_read_counter(int n) {
+  uint64 x = 0;
+  switch (n) {
+    case 0:
+      asm volatile("csrr %0, cycle" : "=r"(x));
+      break;
+    case 2:
+      asm volatile("csrr %0, instret" : "=r"(x));
+      break;
+#define PERF_READ_HPM(i)                                   \
+  case i:                                                  \
+    asm volatile("csrr %0, hpmcounter" #i : "=r"(x));      \
+    break;
+    PERF_HPM_COUNTERS(PERF_READ_HPM)
+#undef PERF_READ_HPM
+  }
+  return x;
+}
+
+// kernel side. defined in kernel/perf.c
+struct process_t;
+ssize_t sys_perf_event_open(uint64 event);
+ssize_t sys_perf_event_close(long counter);
+void perf_switch_out(struct process_t *p);
+void perf_switch_in(struct process_t *p);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ * Physical memory manager. The free physical memory is managed by a buddy allocator: free
+ * blocks of 2^order pages (order 0 ... PMM_MAX_ORDER) are chained in a list per order, and a
+ * freed block merges with its buddy (the other half of the block of the next order) when the
+ * buddy is free as well.
+ *
+ * Single pages, by far the most common requests (page tables, user pages, stacks), are served
+ * from a per-hart magazine of free pages first: alloc_page() and free_page() take no lock
+ * unless the magazine of the hart runs empty or full, when half a magazine is moved from or to
+ * the buddy allocator at once.
+ */
+
+#include "pmm.h"
+#include "util/functions.h"
+#include "riscv.h"
+#include "config.h"
+#include "string.h"
+#include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
+
+// _end is defined in kernel/kernel.lds, it marks the ending (virtual) address of PKE kernel
+extern char _end[];
+// g_mem_size is defined in spike_interface/spike_memory.c, it indicates the size of our
+// (emulated) spike machine. g_mem_size's value is obtained when initializing HTIF.
+extern uint64 g_mem_size;
+
+static uint64 free_mem_start_addr;  //beginning address of free memory
+static uint64 free_mem_end_addr;    //end address of free memory (not included)
+static uint64 nr_pages;             // pages in [free_mem_start_addr, free_mem_end_addr)
+
+#define MAX_PAGES ((PKE_MAX_ALLOWABLE_RAM) / PGSIZE)
+
+// a free block, the links are stored in its first page
+typedef struct free_block_t {
+  struct free_block_t *next, *prev;
+} free_block;
+
+// circular lists of free blocks, one per order, and their lengths
+static free_block free_lists[PMM_MAX_ORDER + 1];
+static uint64 nr_free[PMM_MAX_ORDER + 1];
+// block_order[i] is order + 1 if page i heads a free block of that order, 0 otherwise
+static uint8 block_order[MAX_PAGES];
+static spinlock_t buddy_lock = SPINLOCK_INIT;
+
+// per-hart cache of free single pages, and allocation statistics of the hart
+typedef struct magazine_t {
+  void *pages[PMM_MAG_SIZE];
+  int n;
+  uint64 allocs;       // alloc_page() calls
+  uint64 hits;         // served by the magazine
+  uint64 cycles;       // total latency of alloc_page()
+  uint64 max_cycles;   // worst latency of alloc_page()
+} magazine;
+
+static magazine magazines[NCPU];
+
+// pages handed out by the buddy allocator (the ones cached in the magazines included), and its
+// maximum so far
+static uint64 pages_used, pages_used_max;
+
+static inline uint64 page_index(void *pa) { return ((uint64)pa - free_mem_start_addr) / PGSIZE; }
+static inline void *page_addr(uint64 i) { return (void *)(free_mem_start_addr + i * PGSIZE); }
+
+// account for n pages handed out (or returned, if n is negative), and the high-water mark.
+static void pages_used_add(long n) {
+  uint64 used = atomic_add(&pages_used, n) + n;
+  uint64 max;
+  while (n > 0 && used > (max = atomic_read(&pages_used_max)) &&
+         atomic_cas(&pages_used_max, max, used) != max)
+    ;
+}
+
+static void list_push(int order, uint64 i) {
+  free_block *b = page_addr(i), *head = &free_lists[order];
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  block_order[i] = order + 1;
+  nr_free[order]++;
+}
+
+static void list_remove(int order, uint64 i) {
+  free_block *b = page_addr(i);
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  block_order[i] = 0;
+  nr_free[order]--;
+}
+
+//
+// allocate a block of 2^order physical pages, aligned to its size (relative to the start of
+// free memory). returns NULL when running out of memory.
+//
+void *alloc_pages(int order) {
+  if (order < 0 || order > PMM_MAX_ORDER) return NULL;
+
+  long flags = spinlock_lock_irqsave(&buddy_lock);
+  int o = order;
+  while (o <= PMM_MAX_ORDER && !nr_free[o]) o++;
+  if (o > PMM_MAX_ORDER) {
+    spinlock_unlock_irqrestore(&buddy_lock, flags);
+    return NULL;
+  }
+
+  uint64 i = page_index(free_lists[o].next);
+  list_remove(o, i);
+  // split the block, freeing the upper halves
+  while (o > order) {
+    o--;
+    list_push(o, i + (1UL << o));
+  }
+  spinlock_unlock_irqrestore(&buddy_lock, flags);
+  pages_used_add(1L << order);
+  return page_addr(i);
+}
+
+//
+// free a block of 2^order pages got by alloc_pages(order), merging it with its free buddies.
+//
+void free_pages(void *pa, int order) {
+  if (((uint64)pa % PGSIZE) != 0 || (uint64)pa < free_mem_start_addr ||
+      (uint64)pa >= free_mem_end_addr || order < 0 || order > PMM_MAX_ORDER)
+    panic("free_pages 0x%lx \n", pa);
+
+  uint64 i = page_index(pa);
+  long flags = spinlock_lock_irqsave(&buddy_lock);
+  if (block_order[i]) panic("free_pages: double free of 0x%lx \n", pa);
+  pages_used_add(-(1L << order));
+
+  while (order < PMM_MAX_ORDER) {
+    uint64 buddy = i ^ (1UL << order);
+    if (buddy >= nr_pages || block_order[buddy] != order + 1) break;
+    list_remove(order, buddy);
+    i &= ~(1UL << order);
+    order++;
+  }
+  list_push(order, i);
+  spinlock_unlock_irqrestore(&buddy_lock, flags);
+}
+
+//
+// allocate one physical page, from the magazine of the calling hart if possible. returns NULL
+// when running out of memory.
+//
+void *alloc_page(void) {
+  uint64 start = read_cycle();
+  long flags = disable_irqsave();
+  magazine *m = &magazines[read_tp()];
+
+  m->allocs++;
+  if (m->n)
+    m->hits++;
+  else
+    // refill half of the magazine.
+    while (m->n < PMM_MAG_SIZE / 2) {
+      void *pa = alloc_pages(0);
+      if (!pa) break;
+      m->pages[m->n++] = pa;
+    }
+  void *pa = m->n ? m->pages[--m->n] : NULL;
+
+  uint64 cycles = read_cycle() - start;
+  m->cycles += cycles;
+  m->max_cycles = MAX(m->max_cycles, cycles);
+  enable_irqrestore(flags);
+  return pa;
+}
+
+//
+// free a physical page got by alloc_page(), into the magazine of the calling hart.
+//
+void free_page(void *pa) {
+  if (((uint64)pa % PGSIZE) != 0 || (uint64)pa < free_mem_start_addr || (uint64)pa >= free_mem_end_addr)
+    panic("free_page 0x%lx \n", pa);
+
+  long flags = disable_irqsave();
+  magazine *m = &magazines[read_tp()];
+  // flush half of a full magazine.
+  if (m->n == PMM_MAG_SIZE)
+    while (m->n > PMM_MAG_SIZE / 2) free_pages(m->pages[--m->n], 0);
+  m->pages[m->n++] = pa;
+  enable_irqrestore(flags);
+}
+
+//
+// print the usage of physical memory: high-water mark, fragmentation of the free memory (the
+// share of free pages outside of the largest free block) and the latency of alloc_page().
+//
+void pmm_report(void) {
+  long flags = spinlock_lock_irqsave(&buddy_lock);
+  uint64 free = 0;
+  int largest = -1;
+  for (int o = 0; o <= PMM_MAX_ORDER; o++) {
+    free += nr_free[o] << o;
+    if (nr_free[o]) largest = o;
+  }
+  // the magazines of other harts may change meanwhile, the sum is a snapshot
+  uint64 cached = 0;
+  for (int h = 0; h < NCPU; h++) cached += atomic_read(&magazines[h].n);
+  log_info("pmm: %ld pages, %ld used (at most %ld) of which %ld cached in magazines, %ld free in "
+           "the buddy allocator\n", nr_pages, pages_used, pages_used_max, cached, free);
+  for (int o = 0; o <= PMM_MAX_ORDER; o++)
+    if (nr_free[o]) log_info("  order %d: %ld free blocks\n", o, nr_free[o]);
+  if (free)
+    log_info("  fragmentation: %ld percent of the free pages are outside of the largest "
+             "block\n", 100 - (1UL << largest) * 100 / free);
+  spinlock_unlock_irqrestore(&buddy_lock, flags);
+
+  for (int h = 0; h < NCPU; h++) {
+    magazine *m = &magazines[h];
+    if (!m->allocs) continue;
+    log_info("  hart %d: %ld page allocations, %ld percent from the magazine, %ld cycles on "
+             "average, %ld at most\n", h, m->allocs, m->hits * 100 / m->allocs,
+             m->cycles / m->allocs, m->max_cycles);
+  }
+}
+
+//
+// hand the pages [start, end) to the buddy allocator, as the largest aligned blocks possible.
+//
+static void create_free_blocks(uint64 start, uint64 end) {
+  for (int o = 0; o <= PMM_MAX_ORDER; o++) free_lists[o].next = free_lists[o].prev = &free_lists[o];
+
+  nr_pages = MIN((end - start) / PGSIZE, MAX_PAGES);
+  for (uint64 i = 0; i < nr_pages;) {
+    int o = PMM_MAX_ORDER;
+    while ((i & ((1UL << o) - 1)) || i + (1UL << o) > nr_pages) o--;
+    list_push(o, i);
+    i += 1UL << o;
+  }
+}
+
+//
+// pmm_init() will initialize the physical memory manager, i.e., the free pages after the
+// kernel image (marked by _end) up to the end of the emulated memory.
+//
+void pmm_init() {
+  // start of kernel program segment
+  uint64 g_kernel_start = KERN_BASE;
+  uint64 g_kernel_end = (uint64)&_end;
+
+  uint64 pke_kernel_size = g_kernel_end - g_kernel_start;
+  log_info("PKE kernel start 0x%lx, PKE kernel end: 0x%lx, PKE kernel size: 0x%lx .\n",
+    g_kernel_start, g_kernel_end, pke_kernel_size);
+
+  // free memory starts from the end of PKE kernel and must be page-aligined
+  free_mem_start_addr = ROUNDUP(g_kernel_end , PGSIZE);
+
+  // recompute g_mem_size to limit the physical memory space that our riscv-pke kernel
+  // needs to manage
+  g_mem_size = MIN(PKE_MAX_ALLOWABLE_RAM, g_mem_size);
+  if( g_mem_size < pke_kernel_size )
+    panic( "Error when recomputing physical memory size (g_mem_size).\n" );
+
+  free_mem_end_addr = g_mem_size + DRAM_BASE;
+  log_info("free physical memory address: [0x%lx, 0x%lx] \n", free_mem_start_addr,
+    free_mem_end_addr - 1);
+
+  log_info("kernel memory manager is initializing ...\n");
+  // hand the free memory to the buddy allocator
+  create_free_blocks(free_mem_start_addr, free_mem_end_addr);
+}
@@ -0,0 +1,21 @@
+#ifndef _PMM_H_
+#define _PMM_H_
+
+// the largest block of the buddy allocator has 2^PMM_MAX_ORDER pages
+#define PMM_MAX_ORDER 10
+// capacity of the per-hart cache of free pages
+#define PMM_MAG_SIZE 32
+
+// Initialize phisical memeory manager
+void pmm_init();
+// Allocate a free phisical page
+void* alloc_page();
+// Free an allocated page
+void free_page(void* pa);
+// Allocate (free) a block of 2^order contiguous physical pages
+void* alloc_pages(int order);
+void free_pages(void* pa, int order);
+// print the statistics of the physical memory manager
+void pmm_report(void);
+
+#endif
@@ -1,9 +1,9 @@
 /*
- * Utility functions for process management. 
+ * Utility functions for process management.
  *
- * Note: in Lab1, only one process (i.e., our user application) exists. Therefore, 
- * PKE OS at this stage will set "current" to the loaded user application, and also
- * switch to the old "current" process after trap handling.
+ * Note: processes are kept in a fixed-size table (procs), one per application given in the
+ * command line. each hart runs the processes of its run queue (see kernel/sched.c), and
+ * "current" is the process running on the calling hart.
  */
 
 #include "riscv.h"
@@ -12,15 +12,23 @@
 #include "process.h"
 #include "elf.h"
 #include "string.h"
+#include "pmm.h"
+#include "vmm.h"
 
 #include "spike_interface/spike_utils.h"
 
 //Two functions defined in kernel/usertrap.S
 extern char smode_trap_vector[];
-extern void return_to_user(trapframe*);
+extern void return_to_user(trapframe*, uint64 satp);
 
-// current points to the currently running user-mode application.
-process* current = NULL;
+// per-hart state, indexed by hartid. "current" (defined in kernel/process.h) is the running
+// process of the calling hart.
+cpu cpus[NCPU];
+
+// process pool, and the number of processes that have not exited
+static process procs[NPROC];
+static int nr_live;
+static spinlock_t procs_lock = SPINLOCK_INIT;
 
 //
 // switch to a user-mode process
@@ -38,6 +46,8 @@ void switch_to(process* proc) {
   // the process next re-enters the kernel.
   proc->trapframe->kernel_sp = proc->kstack;  // process's kernel stack
   proc->trapframe->kernel_trap = (uint64)smode_trap_handler;
+  proc->trapframe->kernel_satp = read_csr(satp);  // kernel page table
+  proc->trapframe->kernel_hartid = read_tp();      // hartid, restored to tp on traps
 
   // SSTATUS_SPP and SSTATUS_SPIE are defined in kernel/riscv.h
   // set S Previous Privilege mode (the SSTATUS_SPP bit in sstatus register) to User mode.
@@ -51,6 +61,62 @@ void switch_to(process* proc) {
   // set S Exception Program Counter (sepc register) to the elf entry pc.
   write_csr(sepc, proc->trapframe->epc);
 
+  // make user page table. macro MAKE_SATP is defined in kernel/riscv.h.
+  uint64 user_satp = MAKE_SATP(proc->pagetable);
+
   // return_to_user() is defined in kernel/strap_vector.S. switch to user mode with sret.
-  return_to_user(proc->trapframe);
+  // note, return_to_user takes two parameters.
+  return_to_user(proc->trapframe, user_satp);
+}
+
+//
+// allocate an empty process from the process table, and its trapframe, page directory and
+// "user kernel" stack. the trap context and the stack are prepared in its address space.
+// returns NULL if the table is full.
+//
+process* alloc_process(void) {
+  process* proc = NULL;
+  long flags = spinlock_lock_irqsave(&procs_lock);
+  for (int i = 0; i < NPROC; i++)
+    if (procs[i].status == FREE) {
+      proc = &procs[i];
+      memset(proc, 0, sizeof(process));
+      proc->pid = i;
+      proc->status = READY;
+      nr_live++;
+      break;
+    }
+  spinlock_unlock_irqrestore(&procs_lock, flags);
+  if (!proc) return NULL;
+
+  // alloc_page is defined in kernel/pmm.c
+  proc->trapframe = (trapframe*)alloc_page();
+  proc->pagetable = (pagetable_t)alloc_page();
+  void* kstack = alloc_page();
+  if (!proc->trapframe || !proc->pagetable || !kstack)
+    panic("alloc_process: out of physical memory.\n");
+
+  memset(proc->trapframe, 0, sizeof(trapframe));
+  memset((void*)proc->pagetable, 0, PGSIZE);
+  proc->kstack = (uint64)kstack + PGSIZE;  // user kernel stack top
+  proc->trapframe->regs.sp = USER_STACK_TOP;
+
+  // map the trap context, and prepare the (demand-populated) stack. defined in kernel/vmm.c
+  user_vm_init(proc);
+  return proc;
+}
+
+//
+// mark an exited process as ZOMBIE, and close its elf file. its memory is not reclaimed, as
+// the kernel may still run on its kernel stack. returns the number of processes left.
+//
+int free_process(process* proc) {
+  if (proc->elf_file) spike_file_put(proc->elf_file);
+  proc->elf_file = NULL;
+
+  long flags = spinlock_lock_irqsave(&procs_lock);
+  proc->status = ZOMBIE;
+  int left = --nr_live;
+  spinlock_unlock_irqrestore(&procs_lock, flags);
+  return left;
 }
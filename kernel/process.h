@@ -2,6 +2,11 @@
 #define _PROC_H_
 
 #include "riscv.h"
+#include "config.h"
+#include "timer.h"
+#include "perf.h"
+#include "spike_interface/atomic.h"
+#include "spike_interface/spike_htif.h"
 
 typedef struct trapframe_t {
   // space to store context (all common registers)
@@ -13,18 +18,149 @@ typedef struct trapframe_t {
   /* offset:256 */ uint64 kernel_trap;
   // saved user process counter
   /* offset:264 */ uint64 epc;
+
+  // kernel page table, installed by smode_trap_vector when entering the kernel
+  /* offset:272 */ uint64 kernel_satp;
+  // user page table, saved by smode_trap_vector for the fast syscall return path
+  /* offset:280 */ uint64 user_satp;
+  // hartid of the hart running the process, loaded to tp by smode_trap_vector
+  /* offset:288 */ uint64 kernel_hartid;
 }trapframe;
 
+// the maximum number of regions in the address space of a process
+#define MAX_VM_REGIONS 16
+
+// a region of the user address space, whose pages are populated on demand (page fault).
+// the first filesz bytes are backed by the elf file of the process, the rest are zeros.
+typedef struct vm_region_t {
+  uint64 va;      // start virtual address
+  uint64 memsz;   // size of the region in memory
+  uint64 filesz;  // size of the part backed by the elf file
+  uint64 off;     // offset of the backing content in the elf file
+  int prot;       // PROT_READ | PROT_WRITE | PROT_EXEC, defined in kernel/vmm.h
+  int mmapped;    // an anonymous mapping of SYS_mmap, the only regions SYS_munmap removes
+
+  // statistics of demand loading
+  uint64 pages_loaded;  // pages populated
+  uint64 bytes_read;    // bytes read from the host
+  uint64 load_ticks;    // mtime ticks spent in reading from the host
+} vm_region;
+
+struct file;
+struct uring_t;
+struct elf_symtab_t;
+
+// status of a process
+enum proc_status {
+  FREE,     // unused slot of the process table
+  READY,    // in a run queue
+  RUNNING,  // running on a hart
+  BLOCKED,  // sleeping, or waiting for the host, e.g., until its sleep_timer fires
+  ZOMBIE,   // exited
+};
+
+// length of the name of a process (the path of its elf file), including the ending NUL
+#define PROC_NAME_LEN 32
+
 // the extremely simple definition of process, used for begining labs of PKE
 typedef struct process_t {
   // pointing to the stack used in trap handling.
   uint64 kstack;
+  // user page table
+  pagetable_t pagetable;
   // trapframe storing the context of a (User mode) process.
   trapframe* trapframe;
+
+  // the (host) elf file of the process. it stays open, as pages are loaded on demand.
+  struct file* elf_file;
+  // regions of the user address space
+  vm_region regions[MAX_VM_REGIONS];
+  int nregions;
+  // the heap region, NULL until the first SYS_sbrk. it starts at heap_base, the end of the
+  // elf segments, and its end is the program break.
+  vm_region* heap;
+  uint64 heap_base;
+  // the lowest address of the anonymous mappings (SYS_mmap), which grow downward
+  uint64 mmap_base;
+
+  // syscall rings shared with the application, NULL until SYS_uring_setup
+  struct uring_t* uring;
+
+  // index in the process table
+  int pid;
+  // one of enum proc_status
+  int status;
+  char name[PROC_NAME_LEN];
+  // symbol index of the elf, for backtraces and the profiler
+  struct elf_symtab_t* symtab;
+
+  // next process in the run queue (see kernel/sched.c)
+  struct process_t* queue_next;
+  // ticks the process has run in its current time slice
+  uint64 tick_count;
+  // wakes the process up from SYS_sleep and SYS_nanosleep (see kernel/syscall.c)
+  ktimer sleep_timer;
+
+  // events of the hpmcounters of the process (bit i of perf_used: hpmcounter PERF_HPM_BASE+i
+  // is in use), and their counts while the process is not running. see kernel/perf.c
+  uint32 perf_used;
+  uint64 perf_event[PERF_MAX_EVENTS];
+  uint64 perf_count[PERF_MAX_EVENTS];
+
+  // host request of a blocking syscall (e.g., SYS_user_write). it is submitted by the
+  // scheduler once the hart has left the kernel stack of the process, if host_req_pending.
+  htif_req host_req;
+  int host_req_pending;
+  uint64 io_va;    // user buffer of the syscall
+  size_t io_len;   // its length
+  size_t io_done;  // bytes transferred by the completed requests
+  size_t io_chunk; // bytes of the request in flight
 }process;
 
+// per-hart state of the kernel
+typedef struct cpu {
+  // the process running on this hart, NULL if the hart is idle
+  process* proc;
+  // timer ticks of this hart. the tick timer runs only while the hart runs a process.
+  uint64 ticks;
+  ktimer tick_timer;
+  // the current process has used up its time slice
+  int need_resched;
+  // the hart is idle (waiting in wfi) in the scheduler, see wake_hart() in kernel/sched.c
+  volatile int idle;
+  // the syscall being served was called by the ecall of current process (not through the
+  // syscall rings), so that it may block the process. see handle_syscall() in kernel/strap.c
+  int may_block;
+
+  // min-heap of the pending timers of this hart, and the deadline the hardware timer is
+  // programmed for. see kernel/timer.c
+  ktimer* timer_heap[TIMER_HEAP_SIZE];
+  int nr_timers;
+  uint64 timer_armed;
+  int timer_running;
+
+  // run queue of the hart, of READY processes. see kernel/sched.c
+  spinlock_t rq_lock;
+  process* rq_head;
+  process* rq_tail;
+  int nr_ready;
+
+  // the process whose events are programmed into the hpmcounters, see kernel/perf.c
+  process* perf_owner;
+} cpu;
+
+extern cpu cpus[NCPU];
+
+// the cpu of the calling hart. in S-mode, tp holds the hartid (set by m_start() and by
+// smode_trap_vector), as mhartid is not accessible.
+static inline cpu* mycpu(void) { return &cpus[read_tp()]; }
+
 void switch_to(process*);
 
-extern process* current;
+process* alloc_process(void);
+int free_process(process* proc);
+
+// current points to the process running on the calling hart.
+#define current (mycpu()->proc)
 
 #endif
@@ -0,0 +1,184 @@
+/*
+ * A sampling profiler driven by the timer tick. On each tick that interrupts a user
+ * application, the interrupted pc and a short frame-pointer walk of the user stack are
+ * recorded into a fixed-size hash table. When the last application exits, per-function hit
+ * counts are printed, and the collapsed stacks (the input format of flamegraph.pl, rooted at
+ * the name of each application) are written to a host file.
+ */
+
+#include "profile.h"
+#include "config.h"
+#include "elf.h"
+#include "vmm.h"
+#include "string.h"
+#include "util/functions.h"
+#include "util/snprintf.h"
+#include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
+
+typedef struct prof_sample_t {
+  process *proc;              // the sampled process, whose symbols name the pcs
+  uint64 pc[PROF_MAX_DEPTH];  // pc[0] is the interrupted pc, pc[i] is the caller of pc[i-1]
+  int depth;                  // 0 marks an unused slot
+  uint64 count;
+} prof_sample;
+
+static prof_sample prof_table[PROF_TABLE_SIZE];
+static uint64 prof_total, prof_dropped;
+// the harts sample their processes concurrently
+static spinlock_t prof_lock = SPINLOCK_INIT;
+
+// read a word of the user stack, without populating pages. returns 0 if va is not mapped.
+static uint64 read_user_stack(process *p, uint64 va) {
+  if (va & 7) return 0;
+  uint64 *pa = user_va_to_pa(p->pagetable, (void *)va);
+  return pa ? *pa : 0;
+}
+
+//
+// record one sample of process p. called in the timer interrupt handler.
+//
+void profile_tick(process *p) {
+  uint64 pc[PROF_MAX_DEPTH];
+  int depth = 0;
+
+  pc[depth++] = p->trapframe->epc;
+  // walk the frame pointers: the return address is saved at fp-8, and the frame pointer of
+  // the caller is saved at fp-16.
+  uint64 fp = p->trapframe->regs.s0;
+  while (depth < PROF_MAX_DEPTH && fp) {
+    uint64 ra = read_user_stack(p, fp - 8);
+    if (!ra) break;
+    pc[depth++] = ra;
+    fp = read_user_stack(p, fp - 16);
+  }
+
+  // FNV-1a hash of the process and its call stack, then linear probing.
+  uint64 h = (0xcbf29ce484222325ULL ^ p->pid) * 0x100000001b3ULL;
+  for (int i = 0; i < depth; i++) h = (h ^ pc[i]) * 0x100000001b3ULL;
+
+  long flags = spinlock_lock_irqsave(&prof_lock);
+  prof_total++;
+  for (uint64 i = 0; i < PROF_TABLE_SIZE; i++) {
+    prof_sample *s = &prof_table[(h + i) & (PROF_TABLE_SIZE - 1)];
+    if (s->depth == 0) {
+      s->proc = p;
+      memcpy(s->pc, pc, sizeof(uint64) * depth);
+      s->depth = depth;
+      s->count = 1;
+      goto out;
+    }
+    if (s->proc == p && s->depth == depth) {
+      int k;
+      for (k = 0; k < depth && s->pc[k] == pc[k]; k++)
+        ;
+      if (k == depth) {
+        s->count++;
+        goto out;
+      }
+    }
+  }
+  prof_dropped++;
+out:
+  spinlock_unlock_irqrestore(&prof_lock, flags);
+}
+
+//
+// buffered output to the host file holding the collapsed stacks.
+//
+static char out_buf[1024];
+static int out_len;
+
+static void out_flush(spike_file_t *f) {
+  if (out_len) spike_file_write(f, out_buf, out_len);
+  out_len = 0;
+}
+
+static void out_append(spike_file_t *f, const char *s) {
+  for (; *s; s++) {
+    if (out_len == sizeof(out_buf)) out_flush(f);
+    out_buf[out_len++] = *s;
+  }
+}
+
+static void out_frame(spike_file_t *f, process *p, uint64 pc) {
+  const char *name = elf_symtab_lookup(p->symtab, pc);
+  if (name) {
+    out_append(f, name);
+  } else {
+    char hex[24];
+    snprintf(hex, sizeof(hex), "0x%lx", pc);
+    out_append(f, hex);
+  }
+}
+
+//
+// print per-function hit counts, and write the collapsed stacks to PROFILE_OUTPUT.
+//
+void profile_report(void) {
+  // per-function (self) hit counts. names come from the symbol index, so identical
+  // functions share the same name pointer.
+  static struct {
+    const char *name;
+    uint64 count;
+  } funcs[PROF_TABLE_SIZE];
+  int nfuncs = 0;
+  uint64 unknown = 0;
+
+  if (!prof_total) return;
+
+  for (prof_sample *s = prof_table; s < prof_table + PROF_TABLE_SIZE; s++) {
+    if (!s->depth) continue;
+    const char *name = elf_symtab_lookup(s->proc->symtab, s->pc[0]);
+    if (!name) {
+      unknown += s->count;
+      continue;
+    }
+    int i;
+    for (i = 0; i < nfuncs && funcs[i].name != name; i++)
+      ;
+    if (i == nfuncs) {
+      funcs[nfuncs].name = name;
+      funcs[nfuncs++].count = 0;
+    }
+    funcs[i].count += s->count;
+  }
+
+  // sort by hit count, descending
+  for (int i = 1; i < nfuncs; i++)
+    for (int j = i; j > 0 && funcs[j].count > funcs[j - 1].count; j--) {
+      const char *name = funcs[j].name;
+      uint64 count = funcs[j].count;
+      funcs[j] = funcs[j - 1];
+      funcs[j - 1].name = name;
+      funcs[j - 1].count = count;
+    }
+
+  log_info("Profile: %ld samples (%ld dropped).\n", prof_total, prof_dropped);
+  for (int i = 0; i < nfuncs; i++) log_info("%ld\t%s\n", funcs[i].count, funcs[i].name);
+  if (unknown) log_info("%ld\t[unknown]\n", unknown);
+
+  spike_file_t *f = spike_file_open(PROFILE_OUTPUT, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (IS_ERR_VALUE(f)) {
+    log_warn("Profile: fail to open %s.\n", PROFILE_OUTPUT);
+    return;
+  }
+
+  // one line per call stack: "outermost;...;innermost count"
+  for (prof_sample *s = prof_table; s < prof_table + PROF_TABLE_SIZE; s++) {
+    if (!s->depth) continue;
+    char count[24];
+    out_append(f, s->proc->name);
+    out_append(f, ";");
+    for (int i = s->depth - 1; i >= 0; i--) {
+      out_frame(f, s->proc, s->pc[i]);
+      out_append(f, i ? ";" : " ");
+    }
+    snprintf(count, sizeof(count), "%ld\n", s->count);
+    out_append(f, count);
+  }
+  out_flush(f);
+  spike_file_put(f);
+
+  log_info("Profile: collapsed stacks written to %s.\n", PROFILE_OUTPUT);
+}
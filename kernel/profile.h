@@ -0,0 +1,14 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "process.h"
+
+// the number of frames recorded for one sample (the interrupted pc included)
+#define PROF_MAX_DEPTH 8
+// number of distinct call stacks the profiler can hold, must be a power of 2
+#define PROF_TABLE_SIZE 512
+
+void profile_tick(process *p);
+void profile_report(void);
+
+#endif
@@ -55,15 +55,38 @@
 // irqs (interrupts). added @lab1_3
 #define CAUSE_MTIMER 0x8000000000000007
 #define CAUSE_MTIMER_S_TRAP 0x8000000000000001
+#define CAUSE_MSOFT 0x8000000000000003
+// S-mode timer interrupt, taken directly in S-mode with Sstc (see timer_program())
+#define CAUSE_STIMER_S_TRAP 0x8000000000000005
 
 //Supervisor interrupt-pending register
 #define SIP_SSIP (1L << 1)
+#define SIP_STIP (1L << 5)
+
+// the STCE bit of menvcfg, enabling stimecmp of the Sstc extension
+#define MENVCFG_STCE (1UL << 63)
+
+// stimecmp (CSR 0x14d) of Sstc, the S-mode timer compare register. with Sstc, the S-mode timer
+// interrupt is pending whenever time >= stimecmp. the CSR is written by number, as older
+// assemblers do not know its name.
+static inline void write_stimecmp(uint64 x) { asm volatile("csrw 0x14d, %0" ::"r"(x)); }
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4 * (hartid))  // machine software interrupt pending
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8 * (hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8)  // cycles since boot.
 
+// read the cycle counter. access from S-mode is granted by mcounteren (see m_start)
+static inline uint64 read_cycle(void) {
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r"(x));
+  return x;
+}
+
+// read the (memory mapped) mtime register of CLINT
+static inline uint64 read_mtime(void) { return *(volatile uint64 *)CLINT_MTIME; }
+
 // fields of sstatus, the Supervisor mode Status register
 #define SSTATUS_SPP (1L << 8)   // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5)  // Supervisor Previous Interrupt Enable
@@ -83,6 +106,12 @@
 #define MIE_MTIE (1L << 7)   // timer
 #define MIE_MSIE (1L << 3)   // software
 
+// fields of mcounteren/scounteren, enabling lower privilege modes to read the counters
+#define COUNTEREN_CY (1L << 0)  // cycle
+#define COUNTEREN_TM (1L << 1)  // time
+#define COUNTEREN_IR (1L << 2)  // instret
+#define COUNTEREN_HPM (0xfffffff8L)  // hpmcounter3 - hpmcounter31
+
 #define read_const_csr(reg)              \
   ({                                     \
     unsigned long __tmp;                 \
@@ -147,6 +176,48 @@ static inline uint64 read_tp(void) {
 // write tp, the thread pointer, holding hartid (core number), the index into cpus[].
 static inline void write_tp(uint64 x) { asm volatile("mv tp, %0" : : "r"(x)); }
 
+// use riscv's sv39 page table scheme.
+#define SATP_SV39 (8L << 60)
+#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+
+// flush the TLB.
+static inline void flush_tlb(void) { asm volatile("sfence.vma zero, zero"); }
+
+#define PGSIZE 4096  // bytes per page
+#define PGSHIFT 12   // offset bits within a page
+
+// page table entry (PTE) fields
+#define PTE_V (1L << 0)  // valid
+#define PTE_R (1L << 1)  // readable
+#define PTE_W (1L << 2)  // writable
+#define PTE_X (1L << 3)  // executable
+#define PTE_U (1L << 4)  // 1 -> user can access
+#define PTE_G (1L << 5)  // global
+#define PTE_A (1L << 6)  // accessed
+#define PTE_D (1L << 7)  // dirty
+
+// shift a physical address to the right place for a PTE.
+#define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
+
+// convert a pte content into its corresponding physical address
+#define PTE2PA(pte) (((pte) >> 10) << 12)
+
+// extract the property bits of a pte
+#define PTE_FLAGS(pte) ((pte)&0x3FF)
+
+// extract the three 9-bit page table indices from a virtual address.
+#define PXMASK 0x1FF  // 9 bits
+#define PXSHIFT(level) (PGSHIFT + (9 * (level)))
+#define PX(level, va) ((((uint64)(va)) >> PXSHIFT(level)) & PXMASK)
+
+// one beyond the highest possible virtual address.
+// MAXVA is actually one bit less than the max allowed by Sv39, to avoid having to
+// sign-extend virtual addresses that have the high bit set.
+#define MAXVA (1L << (9 + 9 + 9 + 12 - 1))
+
+typedef uint64 pte_t;
+typedef uint64 *pagetable_t;  // 512 PTEs
+
 typedef struct riscv_regs_t {
   /*  0  */ uint64 ra;
   /*  8  */ uint64 sp;
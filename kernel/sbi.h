@@ -0,0 +1,32 @@
+#ifndef _SBI_H_
+#define _SBI_H_
+
+#include "util/types.h"
+
+//
+// calls from S-mode to the M-mode part of PKE (handled in kernel/machine/mtrap.c), in the
+// manner of the legacy extensions of RISC-V SBI: a7 holds the function, a0-a2 hold the
+// arguments, and a0 the return value.
+//
+#define SBI_SET_TIMER 0
+#define SBI_PERF_CONFIG 1
+
+static inline uint64 sbi_call(uint64 which, uint64 arg0, uint64 arg1, uint64 arg2) {
+  register uint64 a0 asm("a0") = arg0;
+  register uint64 a1 asm("a1") = arg1;
+  register uint64 a2 asm("a2") = arg2;
+  register uint64 a7 asm("a7") = which;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a7) : "memory");
+  return a0;
+}
+
+// program a one-shot timer interrupt of the calling hart at mtime "stime". -1 stops the timer.
+static inline void sbi_set_timer(uint64 stime) { sbi_call(SBI_SET_TIMER, stime, 0, 0); }
+
+// select "event" for hpmcounter "counter" (3-31) of the calling hart, and set the counter to
+// "value". event 0 stops the counter. returns 0, or -1 if counter is out of range.
+static inline uint64 sbi_perf_config(uint64 counter, uint64 event, uint64 value) {
+  return sbi_call(SBI_PERF_CONFIG, counter, event, value);
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Process scheduling. Each hart has a run queue of READY processes (in its struct cpu), and
+ * runs them round-robin, TIME_SLICE_LEN ticks at a time (see rrsched() in kernel/strap.c). A
+ * hart whose queue is empty steals the oldest process of the busiest queue, or idles in wfi,
+ * without ticks, until another hart wakes it up by an IPI.
+ */
+
+#include "sched.h"
+#include "riscv.h"
+#include "strap.h"
+#include "vdso.h"
+#include "spike_interface/spike_utils.h"
+
+// stack0 is defined in kernel/machine/minit.c. the scheduler of each hart runs on the top of
+// its boot stack, not on the kernel stack of the previous process.
+extern char stack0[];
+
+//
+// wake up hart hartid from wfi, by raising its machine software interrupt (relayed to S-mode
+// by handle_soft_irq() in kernel/machine/mtrap.c).
+//
+static void wake_hart(int hartid) {
+  *(volatile uint32*)CLINT_MSIP(hartid) = 1;
+}
+
+//
+// wake up an idle hart to run proc just queued at hart hartid: the hart itself, or another
+// one that may steal it.
+//
+static void kick_idle_hart(int hartid) {
+  // pairs with the fence in scheduler(), which publishes idle before checking the queues.
+  mb();
+  if (hartid != read_tp() && cpus[hartid].idle) {
+    wake_hart(hartid);
+    return;
+  }
+  for (uint64 i = 0; i < g_num_harts; i++)
+    if (i != read_tp() && cpus[i].idle) {
+      wake_hart(i);
+      return;
+    }
+}
+
+//
+// append proc to the run queue of hart hartid.
+//
+void insert_to_ready_queue(process* proc, int hartid) {
+  cpu* c = &cpus[hartid];
+  proc->status = READY;
+  proc->queue_next = NULL;
+
+  long flags = spinlock_lock_irqsave(&c->rq_lock);
+  if (c->rq_tail)
+    c->rq_tail->queue_next = proc;
+  else
+    c->rq_head = proc;
+  c->rq_tail = proc;
+  c->nr_ready++;
+  spinlock_unlock_irqrestore(&c->rq_lock, flags);
+
+  kick_idle_hart(hartid);
+}
+
+//
+// take the process at the head of the run queue of c, or NULL if the queue is empty.
+//
+static process* dequeue(cpu* c) {
+  process* proc = NULL;
+  long flags = spinlock_lock_irqsave(&c->rq_lock);
+  if (c->rq_head) {
+    proc = c->rq_head;
+    c->rq_head = proc->queue_next;
+    if (!c->rq_head) c->rq_tail = NULL;
+    c->nr_ready--;
+  }
+  spinlock_unlock_irqrestore(&c->rq_lock, flags);
+  return proc;
+}
+
+//
+// steal a process from the hart with the most READY processes. the queue lengths are read
+// without locks, dequeue() tells whether the victim still has one.
+//
+static process* steal(void) {
+  cpu* victim = NULL;
+  for (uint64 i = 0; i < g_num_harts; i++) {
+    cpu* c = &cpus[i];
+    if (c != mycpu() && c->nr_ready > 0 && (!victim || c->nr_ready > victim->nr_ready))
+      victim = c;
+  }
+  return victim ? dequeue(victim) : NULL;
+}
+
+//
+// the scheduler loop, on the scheduler stack of the hart. prev is the process that ran last,
+// which is queued again if it was preempted.
+//
+static void __attribute__((noreturn)) scheduler(process* prev) {
+  cpu* c = mycpu();
+  // keep the counts of prev before another hart may run it. defined in kernel/perf.c
+  perf_switch_out(prev);
+  if (prev && prev->status == READY) insert_to_ready_queue(prev, read_tp());
+  // the host request prev blocks on may complete (and wake prev up) on any hart, now that
+  // this hart runs on the scheduler stack. htif_submit() is in spike_interface/spike_htif.c
+  if (prev && prev->status == BLOCKED && prev->host_req_pending) {
+    prev->host_req_pending = 0;
+    htif_submit(&prev->host_req);
+  }
+
+  process* next;
+  while (1) {
+    // publish idle before checking the queues, so that a process queued meanwhile wakes up
+    // this hart (see kick_idle_hart()).
+    c->idle = 1;
+    mb();
+    if ((next = dequeue(c)) || (next = steal())) break;
+
+    // sstatus.SIE is clear in S-mode, pending interrupts (timers and IPIs) still wake up the
+    // hart from wfi. the host raises no interrupt on completing a request, so the hart polls
+    // while some are in flight.
+    if (htif_busy()) {
+      htif_poll();
+    } else {
+      // an idle hart gets no ticks to flush the console buffer (see console_tick()), write the
+      // buffered lines out before it sleeps. defined in spike_interface/spike_utils.c
+      console_flush();
+      asm volatile("wfi");
+    }
+    if (read_csr(sip) & (SIP_SSIP | SIP_STIP)) handle_mtimer_trap();
+  }
+  c->idle = 0;
+
+  if (next != prev) log_debug("hart %ld: switch to process %d\n", read_tp(), next->pid);
+  next->status = RUNNING;
+  next->tick_count = 0;
+  c->need_resched = 0;
+  // a blocking syscall leaves handle_syscall() through schedule().
+  c->may_block = 0;
+  // the tick runs while the hart runs a process. tick_start() is defined in kernel/strap.c
+  tick_start();
+  // the time page is stale if no hart has ticked for a while, e.g., all processes slept.
+  // vdso_refresh() is defined in kernel/vdso.c
+  vdso_refresh();
+  perf_switch_in(next);
+  switch_to(next);
+  // switch_to() does not return.
+  while (1)
+    ;
+}
+
+//
+// choose the next process to run on the calling hart, and switch to it. the current process
+// (if any) has been marked READY (preempted) or ZOMBIE (exited). never returns.
+//
+void schedule(void) {
+  process* prev = current;
+  // from now on, this hart runs no process, and may idle in the scheduler.
+  current = NULL;
+
+  // leave the kernel stack of prev before it can be queued, as another hart may pick it up
+  // and trap into the kernel on that stack.
+  register process* a0 asm("a0") = prev;
+  uint64 sp = (uint64)stack0 + 4096 * (read_tp() + 1);
+  asm volatile(
+      "mv sp, %1\n"
+      "jr %2"
+      :
+      : "r"(a0), "r"(sp), "r"(scheduler)
+      : "memory");
+  while (1)
+    ;
+}
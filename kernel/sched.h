@@ -0,0 +1,9 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "process.h"
+
+void insert_to_ready_queue(process* proc, int hartid);
+void schedule(void) __attribute__((noreturn));
+
+#endif
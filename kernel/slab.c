@@ -0,0 +1,272 @@
+/*
+ * Slab allocator of kernel objects. A kmem_cache hands out objects of one size, carved from
+ * slabs (pages got from alloc_page()) and cached per hart: kmem_cache_alloc() and
+ * kmem_cache_free() take no lock unless the cache of the hart runs empty or full, when half of
+ * it is moved from or to the slabs.
+ *
+ * Every object is preceded by a word of metadata: the link of the free list of its slab while
+ * it is there, or a marker telling whether the object is allocated, so that frees of bad or
+ * freed pointers are caught. The constructor of a cache runs once per object, when its slab is
+ * created; objects are expected to be returned in their constructed state.
+ *
+ * kmalloc() serves sizes up to SLAB_MAX_SIZE from caches of power-of-2 sizes, and larger
+ * ones from alloc_pages() directly.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "riscv.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+#define SLAB_MAGIC 0x51ab51ab
+#define KMALLOC_LARGE_MAGIC 0x1a26e1a2
+
+// metadata word of an object: handed out, or in the cache of a hart
+#define SLAB_OBJ_ACTIVE 0xac71feac71feac71ULL
+#define SLAB_OBJ_CACHED 0xcac4edcac4edcac4ULL
+// content of the redzone after an object, in debug mode
+#define SLAB_REDZONE 0xbbbbbbbbbbbbbbbbULL
+#define SLAB_REDZONE_SIZE (SLAB_DEBUG ? sizeof(uint64) : 0)
+
+// header of a slab, at the start of its page
+typedef struct slab_t {
+  uint32 magic;
+  uint32 inuse;  // objects out of the free list
+  kmem_cache* cache;
+  struct slab_t *prev, *next;  // in cache->partial
+  uint64* free;  // metadata word of the first free object
+} slab;
+
+#define SLAB_HEADER_SIZE ROUNDUP(sizeof(slab), 16)
+
+// header of a block allocated by kmalloc() from alloc_pages(), before the returned memory
+typedef struct kmalloc_large_t {
+  uint32 magic;
+  int order;
+  uint64 pad;
+} kmalloc_large;
+
+// the caches of kmalloc(), of sizes 16, 32, ... SLAB_MAX_SIZE
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_NR_CLASSES 8
+static kmem_cache kmalloc_caches[KMALLOC_NR_CLASSES];
+static const char* kmalloc_names[KMALLOC_NR_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"};
+static uint64 kmalloc_large_pages;
+
+// all the caches, for slab_report()
+static kmem_cache* cache_list;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+
+static inline slab* slab_of(void* obj) { return (slab*)ROUNDDOWN((uint64)obj, PGSIZE); }
+static inline uint64* obj_meta(void* obj) { return (uint64*)obj - 1; }
+
+static void partial_push(kmem_cache* c, slab* s) {
+  s->prev = NULL;
+  s->next = c->partial;
+  if (c->partial) c->partial->prev = s;
+  c->partial = s;
+}
+
+static void partial_remove(kmem_cache* c, slab* s) {
+  if (s->prev) s->prev->next = s->next; else c->partial = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+//
+// allocate a slab for c, and construct its objects. c->lock is held.
+//
+static slab* slab_create(kmem_cache* c) {
+  slab* s = alloc_page();
+  if (!s) return NULL;
+  s->magic = SLAB_MAGIC;
+  s->inuse = 0;
+  s->cache = c;
+  s->free = NULL;
+
+  // chain the objects in reverse order, so that they are handed out in address order.
+  for (int i = c->per_slab - 1; i >= 0; i--) {
+    uint64* meta = (uint64*)((char*)s + SLAB_HEADER_SIZE + i * c->stride);
+    void* obj = meta + 1;
+    if (c->ctor) c->ctor(obj);
+    if (SLAB_DEBUG) *(uint64*)((char*)obj + ROUNDUP(c->size, 8)) = SLAB_REDZONE;
+    *meta = (uint64)s->free;
+    s->free = meta;
+  }
+  c->nr_slabs++;
+  partial_push(c, s);
+  return s;
+}
+
+//
+// move objects from the slabs of c to the cache of a hart, up to half of its capacity.
+//
+static void cache_refill(kmem_cache* c, kmem_cache_cpu* cc) {
+  spinlock_lock(&c->lock);
+  while (cc->n < SLAB_CPU_CACHE / 2) {
+    slab* s = c->partial;
+    if (!s && !(s = slab_create(c))) break;
+
+    uint64* meta = s->free;
+    s->free = (uint64*)*meta;
+    s->inuse++;
+    if (!s->free) partial_remove(c, s);
+    *meta = SLAB_OBJ_CACHED;
+    cc->objs[cc->n++] = meta + 1;
+  }
+  spinlock_unlock(&c->lock);
+}
+
+//
+// return n objects of the cache of a hart to their slabs. a slab left empty is freed, unless
+// it is the last one with free objects.
+//
+static void cache_flush(kmem_cache* c, kmem_cache_cpu* cc, int n) {
+  spinlock_lock(&c->lock);
+  while (n-- > 0) {
+    void* obj = cc->objs[--cc->n];
+    slab* s = slab_of(obj);
+    uint64* meta = obj_meta(obj);
+
+    if (!s->free) partial_push(c, s);
+    *meta = (uint64)s->free;
+    s->free = meta;
+    if (--s->inuse == 0 && (s->prev || s->next)) {
+      partial_remove(c, s);
+      s->magic = 0;
+      free_page(s);
+      c->nr_slabs--;
+    }
+  }
+  spinlock_unlock(&c->lock);
+}
+
+static void kmem_cache_setup(kmem_cache* c, const char* name, uint32 size,
+                             void (*ctor)(void* obj)) {
+  if (size == 0 || size > SLAB_MAX_SIZE)
+    panic("kmem_cache: bad object size %d of %s.\n", size, name);
+  memset(c, 0, sizeof(kmem_cache));
+  c->name = name;
+  c->size = size;
+  c->stride = sizeof(uint64) + ROUNDUP(size, 8) + SLAB_REDZONE_SIZE;
+  c->per_slab = (PGSIZE - SLAB_HEADER_SIZE) / c->stride;
+  c->ctor = ctor;
+
+  long flags = spinlock_lock_irqsave(&cache_list_lock);
+  c->next = cache_list;
+  cache_list = c;
+  spinlock_unlock_irqrestore(&cache_list_lock, flags);
+}
+
+//
+// create a cache of objects of "size" bytes, constructed by ctor (may be NULL). returns NULL
+// when running out of memory.
+//
+kmem_cache* kmem_cache_create(const char* name, uint32 size, void (*ctor)(void* obj)) {
+  kmem_cache* c = kmalloc(sizeof(kmem_cache));
+  if (c) kmem_cache_setup(c, name, size, ctor);
+  return c;
+}
+
+//
+// allocate an object of c, from the cache of the calling hart if possible. returns NULL when
+// running out of memory.
+//
+void* kmem_cache_alloc(kmem_cache* c) {
+  long flags = disable_irqsave();
+  kmem_cache_cpu* cc = &c->cpu[read_tp()];
+  if (!cc->n) cache_refill(c, cc);
+
+  void* obj = NULL;
+  if (cc->n) {
+    obj = cc->objs[--cc->n];
+    *obj_meta(obj) = SLAB_OBJ_ACTIVE;
+    cc->allocs++;
+  }
+  enable_irqrestore(flags);
+  return obj;
+}
+
+//
+// free an object got by kmem_cache_alloc(c), into the cache of the calling hart.
+//
+void kmem_cache_free(kmem_cache* c, void* obj) {
+  uint64* meta = obj_meta(obj);
+  if (slab_of(obj)->cache != c || *meta != SLAB_OBJ_ACTIVE)
+    panic("kmem_cache_free: bad or double free of %p (%s).\n", obj, c->name);
+  if (SLAB_DEBUG && *(uint64*)((char*)obj + ROUNDUP(c->size, 8)) != SLAB_REDZONE)
+    panic("kmem_cache_free: redzone of %p (%s) overwritten.\n", obj, c->name);
+  *meta = SLAB_OBJ_CACHED;
+
+  long flags = disable_irqsave();
+  kmem_cache_cpu* cc = &c->cpu[read_tp()];
+  if (cc->n == SLAB_CPU_CACHE) cache_flush(c, cc, SLAB_CPU_CACHE / 2);
+  cc->objs[cc->n++] = obj;
+  cc->frees++;
+  enable_irqrestore(flags);
+}
+
+//
+// allocate size bytes of kernel memory, aligned to 8 bytes. returns NULL when running out of
+// memory.
+//
+void* kmalloc(uint64 size) {
+  if (size == 0) return NULL;
+  for (int i = 0; i < KMALLOC_NR_CLASSES; i++)
+    if (size <= kmalloc_caches[i].size) return kmem_cache_alloc(&kmalloc_caches[i]);
+
+  int order = 0;
+  while ((PGSIZE << order) < size + sizeof(kmalloc_large)) order++;
+  kmalloc_large* h = alloc_pages(order);
+  if (!h) return NULL;
+  h->magic = KMALLOC_LARGE_MAGIC;
+  h->order = order;
+  atomic_add(&kmalloc_large_pages, 1UL << order);
+  return h + 1;
+}
+
+//
+// free memory got by kmalloc(). the page of p tells how it was allocated.
+//
+void kfree(void* p) {
+  if (!p) return;
+  void* page = (void*)ROUNDDOWN((uint64)p, PGSIZE);
+  if (((slab*)page)->magic == SLAB_MAGIC) {
+    kmem_cache_free(((slab*)page)->cache, p);
+    return;
+  }
+
+  kmalloc_large* h = page;
+  if (h->magic != KMALLOC_LARGE_MAGIC || p != h + 1) panic("kfree: bad pointer %p.\n", p);
+  h->magic = 0;
+  atomic_add(&kmalloc_large_pages, -(1L << h->order));
+  free_pages(h, h->order);
+}
+
+//
+// set up the caches of kmalloc(). called by s_start() (kernel/kernel.c) after pmm_init().
+//
+void slab_init(void) {
+  for (int i = 0; i < KMALLOC_NR_CLASSES; i++)
+    kmem_cache_setup(&kmalloc_caches[i], kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i), NULL);
+}
+
+//
+// print the usage of every cache, and of the large blocks of kmalloc().
+//
+void slab_report(void) {
+  for (kmem_cache* c = cache_list; c; c = c->next) {
+    uint64 allocs = 0, frees = 0;
+    for (int h = 0; h < NCPU; h++) {
+      allocs += c->cpu[h].allocs;
+      frees += c->cpu[h].frees;
+    }
+    if (!allocs) continue;
+    log_info("slab %s: %d bytes, %ld slabs, %ld objects in use, %ld allocations\n", c->name,
+             c->size, c->nr_slabs, allocs - frees, allocs);
+  }
+  log_info("kmalloc: %ld pages in large blocks\n", kmalloc_large_pages);
+}
@@ -0,0 +1,56 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "util/types.h"
+#include "config.h"
+#include "spike_interface/atomic.h"
+
+// objects a hart keeps in its cache of a kmem_cache
+#define SLAB_CPU_CACHE 16
+// largest object of a kmem_cache (a slab is one page). kmalloc() takes larger sizes from
+// alloc_pages() directly.
+#define SLAB_MAX_SIZE 2048
+
+// debug mode: a redzone after every object, checked when it is freed. set at build time by
+// "make SLAB_DEBUG=1" (see Makefile).
+#ifndef SLAB_DEBUG
+#define SLAB_DEBUG 0
+#endif
+
+struct slab_t;
+
+// per-hart cache of free objects, and statistics of the hart
+typedef struct kmem_cache_cpu_t {
+  void* objs[SLAB_CPU_CACHE];
+  int n;
+  uint64 allocs;
+  uint64 frees;
+} kmem_cache_cpu;
+
+// a cache of objects of one size, carved from slabs of one page
+typedef struct kmem_cache_t {
+  const char* name;
+  uint32 size;      // size of an object
+  uint32 stride;    // distance between objects in a slab, with their metadata and redzone
+  uint32 per_slab;  // objects in a slab
+  void (*ctor)(void* obj);  // called once on every object, when its slab is created
+
+  spinlock_t lock;  // protects the slabs
+  struct slab_t* partial;  // slabs with free objects
+  uint64 nr_slabs;
+
+  kmem_cache_cpu cpu[NCPU];
+  struct kmem_cache_t* next;  // in the list of all caches, for slab_report()
+} kmem_cache;
+
+void slab_init(void);
+kmem_cache* kmem_cache_create(const char* name, uint32 size, void (*ctor)(void* obj));
+void* kmem_cache_alloc(kmem_cache* c);
+void kmem_cache_free(kmem_cache* c, void* obj);
+
+void* kmalloc(uint64 size);
+void kfree(void* p);
+
+void slab_report(void);
+
+#endif
@@ -6,6 +6,12 @@
 #include "process.h"
 #include "strap.h"
 #include "syscall.h"
+#include "vmm.h"
+#include "profile.h"
+#include "uring.h"
+#include "sched.h"
+#include "timer.h"
+#include "vdso.h"
 
 #include "spike_interface/spike_utils.h"
 
@@ -23,28 +29,92 @@ static void handle_syscall(trapframe *tf) {
   // IMPORTANT: return value should be returned to user app, or else, you will encounter
   // problems in later experiments!
   //panic( "call do_syscall to accomplish the syscall and lab1_1 here.\n" );
+  // the syscall serves the ecall of current process, it may block the process.
+  mycpu()->may_block = 1;
   long ret = do_syscall((*tf).regs.a0, (*tf).regs.a1, (*tf).regs.a2, (*tf).regs.a3,
               (*tf).regs.a4, (*tf).regs.a5, (*tf).regs.a6, (*tf).regs.a7);
-  asm volatile (
-    "add a0, zero, %0"
-    : "=r"(ret)
-  );
+  mycpu()->may_block = 0;
+  // the return value reaches the user app through a0 in its trapframe.
+  tf->regs.a0 = ret;
 }
 
 //
-// global variable that store the recorded "ticks". added @lab1_3
-static uint64 g_ticks = 0;
+// the scheduler tick of a hart, a timer (kernel/timer.c) that is re-armed every TIMER_INTERVAL
+// while the hart runs a process. an idle hart gets no ticks. the ticks are recorded per hart,
+// in mycpu()->ticks.
 //
-// added @lab1_3
+static void tick(ktimer *t) {
+  cpu *c = mycpu();
+  c->ticks++;
+  log_trace("Ticks %d\n", c->ticks);
+  // publish the tick and the time to user space. vdso_tick() is defined in kernel/vdso.c
+  vdso_tick();
+
+  // bound the latency of buffered kernel messages. defined in spike_interface/spike_utils.c
+  console_tick();
+  if (!current) return;
+
+  // sample the interrupted application. profile_tick() is defined in kernel/profile.c
+  profile_tick(current);
+  // serve the syscalls the application queued since the last tick. defined in kernel/uring.c
+  uring_drain(current);
+  // round-robin scheduling, see rrsched() below.
+  if (++current->tick_count >= TIME_SLICE_LEN) c->need_resched = 1;
+
+  timer_add(t, read_mtime() + TIMER_INTERVAL);
+}
+
+//
+// start the tick of the calling hart, if it is stopped. called when switching to a process.
+//
+void tick_start(void) {
+  cpu *c = mycpu();
+  if (c->tick_timer.pending) return;
+  c->tick_timer.fn = tick;
+  timer_add(&c->tick_timer, read_mtime() + TIMER_INTERVAL);
+}
+
+//
+// added @lab1_3. the soft interrupt raised in M-mode by the timer of the hart, or by an IPI,
+// or the S-mode timer interrupt with Sstc. also called by the idle harts (see scheduler() in
+// kernel/sched.c), where current is NULL.
 //
 void handle_mtimer_trap() {
-  sprint("Ticks %d\n", g_ticks);
   // TODO (lab1_3): increase g_ticks to record this "tick", and then clear the "SIP"
   // field in sip register.
   // hint: use write_csr to disable the SIP_SSIP bit in sip.
   //panic( "lab1_3: increase g_ticks by one, and clear SIP field in sip register.\n" );
-  g_ticks ++;
   write_csr(sip, 0);
+  // call the expired timers (e.g., tick() above), and program the next deadline.
+  timer_run();
+}
+
+//
+// round-robin scheduling: the current process gives up the hart after running TIME_SLICE_LEN
+// ticks (defined in kernel/config.h). schedule() is defined in kernel/sched.c
+//
+static void rrsched(void) {
+  cpu *c = mycpu();
+  if (!c->need_resched) return;
+
+  c->need_resched = 0;
+  current->status = READY;
+  schedule();
+}
+
+//
+// the page fault handler. pages of the application are populated on their first touch.
+//
+static void handle_user_page_fault(uint64 mcause, uint64 sepc, uint64 stval) {
+  int access = mcause == CAUSE_FETCH_PAGE_FAULT  ? PROT_EXEC
+               : mcause == CAUSE_LOAD_PAGE_FAULT ? PROT_READ
+                                                 : PROT_WRITE;
+
+  // user_vm_fault() is defined in kernel/vmm.c
+  if (user_vm_fault(current, stval, access) != 0) {
+    log_error("handle_page_fault: illegal access at 0x%lx, sepc=0x%lx\n", stval, sepc);
+    panic("this address is not available!");
+  }
 }
 
 //
@@ -64,14 +134,24 @@ void smode_trap_handler(void) {
   // read_csr() and CAUSE_USER_ECALL are macros defined in kernel/riscv.h
   uint64 cause = read_csr(scause);
 
+  // complete the host requests the host has served meanwhile, e.g., waking up the processes
+  // blocked on them. htif_poll() is defined in spike_interface/spike_htif.c
+  htif_poll();
+
   // we need to handle the timer trap @lab1_3.
   if (cause == CAUSE_USER_ECALL) {
     handle_syscall(current->trapframe);
-  } else if (cause == CAUSE_MTIMER_S_TRAP) {  //soft trap generated by timer interrupt in M mode
+  } else if (cause == CAUSE_MTIMER_S_TRAP || cause == CAUSE_STIMER_S_TRAP) {
+    //soft trap generated by timer interrupt (or IPI) in M mode, or S-mode timer with Sstc
     handle_mtimer_trap();
+    // invoke the round-robin scheduler, which may switch to another process.
+    rrsched();
+  } else if (cause == CAUSE_FETCH_PAGE_FAULT || cause == CAUSE_LOAD_PAGE_FAULT ||
+             cause == CAUSE_STORE_PAGE_FAULT) {
+    handle_user_page_fault(cause, read_csr(sepc), read_csr(stval));
   } else {
-    sprint("smode_trap_handler(): unexpected scause %p\n", read_csr(scause));
-    sprint("            sepc=%p stval=%p\n", read_csr(sepc), read_csr(stval));
+    log_error("smode_trap_handler(): unexpected scause %p\n", read_csr(scause));
+    log_error("            sepc=%p stval=%p\n", read_csr(sepc), read_csr(stval));
     panic( "unexpected exception happened.\n" );
   }
 
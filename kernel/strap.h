@@ -2,5 +2,7 @@
 #define _STRAP_H_
 
 void smode_trap_handler(void);
+void handle_mtimer_trap(void);
+void tick_start(void);
 
 #endif
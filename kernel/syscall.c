@@ -9,25 +9,141 @@
 #include "syscall.h"
 #include "string.h"
 #include "process.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "slab.h"
+#include "profile.h"
+#include "uring.h"
+#include "sched.h"
+#include "perf.h"
 #include "util/functions.h"
 
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/spike_bcache.h"
+#include "spike_interface/atomic.h"
 
 //
 // implement the SYS_user_print syscall
 //
 ssize_t sys_user_print(const char* buf, size_t n) {
-  sprint(buf);
+  // buf is a user virtual address, the string is copied through the user page table.
+  char out[256];
+  n = MIN(n, sizeof(out) - 1);
+  if (copy_from_user(current, out, (uint64)buf, n) < 0) return -1;
+  out[n] = 0;
+  sprint("%s", out);
   return 0;
 }
 
+//
+// write the user buffer to stdout page by page, without being copied or formatted again,
+// waiting for the host.
+//
+static ssize_t user_write_sync(const char* buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    uint64 va = (uint64)buf + done;
+    char *pa = user_va_to_pa(current->pagetable, (void *)va);
+    if (!pa) {
+      if (user_vm_fault(current, va, PROT_READ) != 0) return done ? done : -1;
+      pa = user_va_to_pa(current->pagetable, (void *)va);
+    }
+    size_t len = MIN(n - done, PGSIZE - (va & (PGSIZE - 1)));
+    ssize_t ret = spike_file_write(stdout, pa, len);
+    if (ret < 0) return done ? done : ret;
+    done += ret;
+    if (ret < len) break;
+  }
+  return done;
+}
+
+static int user_write_prepare(process* p);
+
+//
+// completion of a host write of a blocked SYS_user_write, called by htif_poll() on any hart.
+// writes the next page of the buffer, or wakes the process up with the result.
+//
+static void user_write_done(htif_req* req) {
+  process* p = req->arg;
+  long ret = req->magic_mem[0];
+  if (ret > 0) p->io_done += ret;
+
+  if (ret == p->io_chunk && p->io_done < p->io_len && user_write_prepare(p) == 0) {
+    htif_submit(&p->host_req);
+    return;
+  }
+  p->trapframe->regs.a0 = p->io_done ? p->io_done : ret;
+  // insert_to_ready_queue() is defined in kernel/sched.c
+  insert_to_ready_queue(p, read_tp());
+}
+
+// prepare the host write of the page of the buffer of p at p->io_done. the pages have been
+// populated already.
+static int user_write_prepare(process* p) {
+  uint64 va = p->io_va + p->io_done;
+  char* pa = user_va_to_pa(p->pagetable, (void*)va);
+  if (!pa) return -1;
+
+  p->io_chunk = MIN(p->io_len - p->io_done, PGSIZE - (va & (PGSIZE - 1)));
+  frontend_req_init(&p->host_req, HTIFSYS_write, stdout->kfd, (uint64)pa, p->io_chunk, 0, 0, 0,
+                    0);
+  p->host_req.fn = user_write_done;
+  p->host_req.arg = p;
+  return 0;
+}
+
+//
+// implement the SYS_user_write syscall. on the ecall of current process, the process blocks
+// while the host writes the buffer, so that the hart runs other processes meanwhile.
+//
+ssize_t sys_user_write(const char* buf, size_t n) {
+  // keep the order of kernel messages and application output.
+  console_flush();
+  if (!mycpu()->may_block) return user_write_sync(buf, n);
+
+  // populate the pages of the buffer now: the host requests are chained by user_write_done(),
+  // outside of the process.
+  process* p = current;
+  size_t len = 0;
+  while (len < n) {
+    uint64 va = (uint64)buf + len;
+    if (!user_va_to_pa(p->pagetable, (void*)va) && user_vm_fault(p, va, PROT_READ) != 0) break;
+    len += MIN(n - len, PGSIZE - (va & (PGSIZE - 1)));
+  }
+  if (len == 0) return n ? -1 : 0;
+
+  p->io_va = (uint64)buf;
+  p->io_len = len;
+  p->io_done = 0;
+  if (user_write_prepare(p) != 0) return -1;
+
+  // the scheduler submits the request once it has left the kernel stack of p. the result is
+  // set into the trapframe by user_write_done().
+  p->status = BLOCKED;
+  p->host_req_pending = 1;
+  schedule();
+}
+
 //
 // implement the SYS_user_exit syscall
 //
 ssize_t sys_user_exit(uint64 code) {
-  sprint("User exit with code:%d.\n", code);
-  // in lab1, PKE considers only one app (one process). 
-  // therefore, shutdown the system when the app calls exit()
+  log_info("User exit with code:%d (process %d, %s).\n", code, current->pid, current->name);
+  // user_vm_report() is defined in kernel/vmm.c
+  user_vm_report(current);
+
+  // free_process() is defined in kernel/process.c. the other processes keep running.
+  if (free_process(current) > 0) schedule();
+
+  // the last process has exited, shutdown the system.
+  // profile_report() is defined in kernel/profile.c
+  profile_report();
+  syscall_stat_report();
+  // bcache_report() is defined in spike_interface/spike_bcache.c
+  bcache_report();
+  // pmm_report() is defined in kernel/pmm.c, slab_report() in kernel/slab.c
+  pmm_report();
+  slab_report();
   shutdown(code);
 }
 
@@ -35,31 +151,196 @@ ssize_t sys_user_exit(uint64 code) {
 // added in lab1_challenge1
 #include "elf.h"
 
+// read a word of the (user) stack of current process, through its page table.
+static uint64 read_user_word(uint64 va) {
+  uint64 *pa = user_va_to_pa(current->pagetable, (void *)va);
+  return pa ? *pa : 0;
+}
+
 // added in lab1_challenge1
-void sys_user_getfuncname(int depth) {
+ssize_t sys_user_getfuncname(int depth) {
   
-  void *bp, *ip;
+  uint64 bp, ip;
   // asm volatile ("mv %0, s0" : "=r" (bp));// 64bit
   // bp = __builtin_frame_address(0); 
   // if we move this function to user_call we can use this to get bp
   // but we are now in sys_call
-  bp = ((void**)(current->trapframe->regs.s0))[-1]; // 因为do_user_call中直接中断了
+  bp = read_user_word(current->trapframe->regs.s0 - 8); // 因为do_user_call中直接中断了
   //并且没有调用其它函数，所以其ra直接保存在ra寄存器当中，所以 bp - 8就是上一层的bp
   //即为print_backtrace的bp
 
   for (int i = 0; i < depth;++ i) {
-    ip = ((void **)bp)[-1]; // bp-8 对应ra返回地址
-    /*const char *function_name =*/ 
-    find_functionName(ip);
+    ip = read_user_word(bp - 8); // bp-8 对应ra返回地址
+    const char *function_name = find_functionName(ip);
+    if (function_name) sprint("%s\n", function_name);
     // 根据返回地址，即上一层指令的地址，我们可以在elf中找到上一层的函数名
     // 因为第一层是print_backtrce，不需要打印出来。
 
-    bp = ((void **)bp)[-2]; // bp-16保存的上一层的bp
-    if (bp == NULL) {
+    bp = read_user_word(bp - 16); // bp-16保存的上一层的bp
+    if (bp == 0) {
       break;
     }
   }
-  return;
+  return 0;
+}
+
+//
+// implement the SYS_syscall_stat syscall: copy the statistics of syscall "sysnum" to buf.
+//
+static syscall_stat syscall_stats[NR_SYSCALLS];
+
+ssize_t sys_syscall_stat(long sysnum, syscall_stat* buf) {
+  if (sysnum < SYS_user_base || sysnum >= SYS_user_base + NR_SYSCALLS) return -1;
+  syscall_stat snapshot = syscall_stats[sysnum - SYS_user_base];
+  return copy_to_user(current, (uint64)buf, &snapshot, sizeof(snapshot)) < 0 ? -1 : 0;
+}
+
+//
+// implement the SYS_user_null and SYS_user_null_slow syscalls, that do nothing. they measure
+// the cost of the fast and the slow trap paths respectively.
+//
+ssize_t sys_user_null(void) {
+  return 0;
+}
+
+//
+// block current process until mtime reaches "deadline". the sleep syscalls return 0 to the
+// process once it is woken up, by sleep_wakeup() called from the timer interrupt of this hart.
+//
+static void sleep_wakeup(ktimer* t) {
+  // insert_to_ready_queue() is defined in kernel/sched.c
+  insert_to_ready_queue((process*)t->arg, read_tp());
+}
+
+static void sleep_until(uint64 deadline) {
+  process* p = current;
+  // handle_syscall() has already moved epc past the ecall, but its return value is lost, as
+  // schedule() does not return: set it now.
+  p->trapframe->regs.a0 = 0;
+  p->status = BLOCKED;
+  p->sleep_timer.fn = sleep_wakeup;
+  p->sleep_timer.arg = p;
+  timer_add(&p->sleep_timer, deadline);
+  schedule();
+}
+
+//
+// the mtime "sec" seconds and "nsec" (< NSEC_PER_SEC) nanoseconds from now. it saturates
+// below -1ULL, which stands for a stopped timer in kernel/timer.c, instead of wrapping around.
+//
+static uint64 sleep_deadline(uint64 sec, uint64 nsec) {
+  uint64 now = read_mtime(), max = -1ULL - 1;
+  if (sec > (max - now) / g_timebase) return max;
+  uint64 deadline = now + sec * g_timebase, frac = ns_to_mtime(nsec);
+  return frac > max - deadline ? max : deadline + frac;
+}
+
+//
+// implement the SYS_sleep syscall
+//
+ssize_t sys_user_sleep(uint64 seconds) {
+  sleep_until(sleep_deadline(seconds, 0));
+  return 0;
+}
+
+//
+// implement the SYS_nanosleep syscall. the process is never interrupted, so rem is always 0.
+//
+ssize_t sys_user_nanosleep(const timespec* req, timespec* rem) {
+  timespec ts;
+  if (copy_from_user(current, &ts, (uint64)req, sizeof(ts)) < 0) return -1;
+  if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= NSEC_PER_SEC) return -1;
+
+  if (rem) {
+    timespec zero = {0, 0};
+    if (copy_to_user(current, (uint64)rem, &zero, sizeof(zero)) < 0) return -1;
+  }
+  sleep_until(sleep_deadline(ts.tv_sec, ts.tv_nsec));
+  return 0;
+}
+
+//
+// implement the SYS_clock_gettime syscall, from mtime (kernel/timer.c converts it).
+//
+ssize_t sys_user_clock_gettime(long clock, timespec* tp) {
+  if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC && clock != CLOCK_MONOTONIC_RAW)
+    return -1;
+
+  uint64 ns = mtime_to_ns(read_mtime());
+  timespec ts = {ns / NSEC_PER_SEC, ns % NSEC_PER_SEC};
+  return copy_to_user(current, (uint64)tp, &ts, sizeof(ts)) < 0 ? -1 : 0;
+}
+
+//
+// implement the SYS_sbrk syscall. returns the previous program break, or -1.
+//
+ssize_t sys_user_sbrk(int64 incr) {
+  return user_vm_sbrk(current, incr);
+}
+
+//
+// implement the SYS_mmap syscall: map len bytes of zero-filled memory anywhere, readable
+// and/or writable by prot. returns the address, or -1.
+//
+ssize_t sys_user_mmap(uint64 len, int prot) {
+  uint64 va = user_vm_mmap(current, len, prot);
+  return va ? va : -1;
+}
+
+//
+// implement the SYS_munmap syscall, on a whole mapping returned by SYS_mmap.
+//
+ssize_t sys_user_munmap(uint64 va, uint64 len) {
+  return user_vm_munmap(current, va, len);
+}
+
+typedef long (*syscall_fn)(long a1, long a2, long a3, long a4, long a5, long a6, long a7);
+
+// the syscall does not return to the caller, e.g., exit, or returns through schedule(), e.g.,
+// sleep, having set the return value in the trapframe itself.
+#define SYSCALL_NORETURN (1 << 0)
+// the syscall is served by fast_syscall_handler(), i.e., it neither uses the callee-saved
+// registers in the trapframe, nor switches to another process.
+#define SYSCALL_FAST (1 << 1)
+// on the ecall of current process, the syscall blocks it and returns through schedule() as
+// a SYSCALL_NORETURN one. from the syscall rings, it serves the call synchronously and returns.
+#define SYSCALL_MAY_BLOCK (1 << 2)
+
+typedef struct syscall_desc_t {
+  const char* name;
+  syscall_fn handler;  // takes nargs arguments, from a1 on
+  int nargs;
+  int flags;
+} syscall_desc;
+
+#define SYSCALL(num, fn, n, f) [(num) - SYS_user_base] = {#fn, (syscall_fn)(fn), (n), (f)}
+
+// the syscall table, indexed by (syscall number - SYS_user_base). append below if adding new
+// syscalls.
+static const syscall_desc syscall_table[NR_SYSCALLS] = {
+  SYSCALL(SYS_user_print, sys_user_print, 2, SYSCALL_FAST),
+  SYSCALL(SYS_user_exit, sys_user_exit, 1, SYSCALL_NORETURN),
+  SYSCALL(SYS_print_backtrace, sys_user_getfuncname, 1, 0),
+  SYSCALL(SYS_user_write, sys_user_write, 2, SYSCALL_MAY_BLOCK),
+  SYSCALL(SYS_syscall_stat, sys_syscall_stat, 2, SYSCALL_FAST),
+  SYSCALL(SYS_uring_setup, sys_uring_setup, 0, 0),
+  SYSCALL(SYS_uring_enter, sys_uring_enter, 0, 0),
+  SYSCALL(SYS_user_null, sys_user_null, 0, SYSCALL_FAST),
+  SYSCALL(SYS_user_null_slow, sys_user_null, 0, 0),
+  SYSCALL(SYS_sleep, sys_user_sleep, 1, SYSCALL_NORETURN),
+  SYSCALL(SYS_nanosleep, sys_user_nanosleep, 2, SYSCALL_NORETURN),
+  SYSCALL(SYS_clock_gettime, sys_user_clock_gettime, 2, SYSCALL_FAST),
+  SYSCALL(SYS_perf_event_open, sys_perf_event_open, 1, 0),
+  SYSCALL(SYS_perf_event_close, sys_perf_event_close, 1, 0),
+  SYSCALL(SYS_sbrk, sys_user_sbrk, 1, SYSCALL_FAST),
+  SYSCALL(SYS_mmap, sys_user_mmap, 2, SYSCALL_FAST),
+  SYSCALL(SYS_munmap, sys_user_munmap, 2, SYSCALL_FAST),
+};
+
+static int log2_bucket(uint64 x) {
+  int b = 0;
+  while (x >>= 1) b++;
+  return MIN(b, SYSCALL_HIST_BUCKETS - 1);
 }
 
 //
@@ -67,19 +348,75 @@ void sys_user_getfuncname(int depth) {
 // returns the code of success, (e.g., 0 means success, fail for otherwise)
 //
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7) {
-  // sprint("%lld\n",a0);
-  switch (a0) {
-    case SYS_user_print:
-      return sys_user_print((const char*)a1, a2);
-    case SYS_user_exit:
-      return sys_user_exit(a1);
-    
-    // added in lab1_challenge1
-    case SYS_print_backtrace:
-      //return (uint64)
-      sys_user_getfuncname(a1);
-      return 0;
-    default:
-      panic("Unknown syscall %ld \n", a0);
+  uint64 idx = a0 - SYS_user_base;
+  if (idx >= NR_SYSCALLS || !syscall_table[idx].handler) {
+    log_error("Unknown syscall %ld \n", a0);
+    return -1;
+  }
+
+  const syscall_desc* desc = &syscall_table[idx];
+  syscall_stat* stat = &syscall_stats[idx];
+  log_trace("syscall %s (%d args): 0x%lx 0x%lx 0x%lx\n", desc->name, desc->nargs, a1, a2, a3);
+
+  // a syscall that never returns switches to another process, which is only possible on the
+  // ecall of current process (e.g., not from the syscall rings).
+  if ((desc->flags & SYSCALL_NORETURN) && !mycpu()->may_block) return -1;
+
+  // a syscall that never returns, or that may block current process, is only counted. the
+  // statistics are shared by all harts.
+  atomic_add(&stat->calls, 1);
+  if ((desc->flags & SYSCALL_NORETURN) ||
+      ((desc->flags & SYSCALL_MAY_BLOCK) && mycpu()->may_block))
+    return desc->handler(a1, a2, a3, a4, a5, a6, a7);
+
+  uint64 start = read_cycle();
+  long ret = desc->handler(a1, a2, a3, a4, a5, a6, a7);
+  uint64 cycles = read_cycle() - start;
+
+  atomic_add(&stat->cycles, cycles);
+  atomic_add(&stat->hist[log2_bucket(cycles)], 1);
+  return ret;
+}
+
+//
+// called by smode_trap_vector (kernel/strap_vector.S) for every ecall from user mode, before
+// the callee-saved registers are stored to the trapframe. serves the SYSCALL_FAST syscalls and
+// returns 1, so that the vector returns to user mode directly; returns 0 for the other
+// syscalls, which then take the slow path through smode_trap_handler().
+//
+int fast_syscall_handler(trapframe *tf) {
+  uint64 idx = tf->regs.a0 - SYS_user_base;
+  if (idx >= NR_SYSCALLS || !(syscall_table[idx].flags & SYSCALL_FAST)) return 0;
+
+  tf->regs.a0 = do_syscall(tf->regs.a0, tf->regs.a1, tf->regs.a2, tf->regs.a3, tf->regs.a4,
+                           tf->regs.a5, tf->regs.a6, tf->regs.a7);
+  return 1;
+}
+
+//
+// print the call counts and latency histograms of all the syscalls that have been called.
+//
+void syscall_stat_report(void) {
+  for (int i = 0; i < NR_SYSCALLS; i++) {
+    syscall_stat* stat = &syscall_stats[i];
+    if (!stat->calls) continue;
+
+    // only the calls that returned without blocking are timed, the histogram counts them
+    uint64 timed = 0;
+    for (int b = 0; b < SYSCALL_HIST_BUCKETS; b++) timed += stat->hist[b];
+
+    // one log_info() per line, so that lines of other harts do not interleave
+    if (!timed) {
+      log_info("syscall %s: %ld calls\n", syscall_table[i].name, stat->calls);
+      continue;
+    }
+    if (timed == stat->calls)
+      log_info("syscall %s: %ld calls, %ld cycles on average\n", syscall_table[i].name,
+               stat->calls, stat->cycles / timed);
+    else
+      log_info("syscall %s: %ld calls, %ld timed: %ld cycles on average\n",
+               syscall_table[i].name, stat->calls, timed, stat->cycles / timed);
+    for (int b = 0; b < SYSCALL_HIST_BUCKETS; b++)
+      if (stat->hist[b]) log_info("  [2^%d, 2^%d) cycles: %ld\n", b, b + 1, stat->hist[b]);
   }
 }
@@ -11,7 +11,60 @@
 
 // added in lab1_challenge1
 #define SYS_print_backtrace (SYS_user_base + 2)
+// write a buffer to stdout as is
+#define SYS_user_write (SYS_user_base + 3)
+
+// query the statistics (syscall_stat below) of a syscall
+#define SYS_syscall_stat (SYS_user_base + 4)
+// map the shared syscall rings (kernel/uring.h), and serve the queued requests
+#define SYS_uring_setup (SYS_user_base + 5)
+#define SYS_uring_enter (SYS_user_base + 6)
+// do nothing, served by the fast trap path and the slow one respectively
+#define SYS_user_null (SYS_user_base + 7)
+#define SYS_user_null_slow (SYS_user_base + 8)
+// block the process for a number of seconds, or a timespec; read a clock into a timespec
+#define SYS_sleep (SYS_user_base + 9)
+#define SYS_nanosleep (SYS_user_base + 10)
+#define SYS_clock_gettime (SYS_user_base + 11)
+// select the event of a hardware performance counter (kernel/perf.h), and release it
+#define SYS_perf_event_open (SYS_user_base + 12)
+#define SYS_perf_event_close (SYS_user_base + 13)
+// move the program break; map and unmap anonymous memory
+#define SYS_sbrk (SYS_user_base + 14)
+#define SYS_mmap (SYS_user_base + 15)
+#define SYS_munmap (SYS_user_base + 16)
+
+// number of syscall slots, i.e., syscall numbers are in [SYS_user_base, SYS_user_base + NR_SYSCALLS)
+#define NR_SYSCALLS 32
+
+// latency histogram of a syscall: hist[i] counts the calls that took [2^i, 2^(i+1)) cycles
+#define SYSCALL_HIST_BUCKETS 32
+
+typedef struct syscall_stat_t {
+  uint64 calls;
+  // sum of the latencies of the calls timed, i.e., that returned without blocking. hist
+  // counts those calls only.
+  uint64 cycles;
+  uint64 hist[SYSCALL_HIST_BUCKETS];
+} syscall_stat;
+
+// clocks of SYS_clock_gettime. all count from boot, as there is no real-time clock. the
+// user library reads CLOCK_REALTIME and CLOCK_MONOTONIC from the time page (kernel/vdso.h),
+// with the resolution of a timer tick; CLOCK_MONOTONIC_RAW always reads mtime by a syscall.
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+#define CLOCK_MONOTONIC_RAW 4
+
+typedef struct timespec_t {
+  int64 tv_sec;
+  int64 tv_nsec;
+} timespec;
 
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7);
 
+struct trapframe_t;
+int fast_syscall_handler(struct trapframe_t *tf);
+
+void syscall_stat_report(void);
+
 #endif
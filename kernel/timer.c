@@ -0,0 +1,142 @@
+/*
+ * One-shot kernel timers, driving the hardware timer of each hart on demand. Nothing is
+ * programmed while no timer is pending, e.g., on an idle hart (tickless idle).
+ *
+ * The hardware timer is stimecmp if the harts support Sstc, whose interrupts are taken in
+ * S-mode directly. Otherwise, it is mtimecmp, programmed through M-mode (SBI_SET_TIMER) which
+ * relays its interrupts to S-mode as soft interrupts.
+ */
+
+#include "timer.h"
+#include "process.h"
+#include "riscv.h"
+#include "sbi.h"
+
+#include "spike_interface/spike_utils.h"
+
+//
+// program the hardware timer of the hart for its earliest timer, or stop it if there is none.
+// the hardware is not touched if the deadline is unchanged.
+//
+static void timer_program(cpu* c) {
+  // timer_run() programs the timer once, after calling all the expired timers.
+  if (c->timer_running) return;
+
+  uint64 deadline = c->nr_timers ? c->timer_heap[0]->deadline : -1ULL;
+  if (deadline == c->timer_armed) return;
+
+  // g_sstc is defined in spike_interface/spike_hart.c, sbi_set_timer() in kernel/sbi.h
+  if (g_sstc)
+    write_stimecmp(deadline);
+  else
+    sbi_set_timer(deadline);
+  c->timer_armed = deadline;
+}
+
+//
+// min-heap operations on the timer heap of c, keeping the index of every timer up to date.
+//
+static void heap_set(cpu* c, int i, ktimer* t) {
+  c->timer_heap[i] = t;
+  t->index = i;
+}
+
+static void sift_up(cpu* c, int i) {
+  ktimer* t = c->timer_heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (c->timer_heap[parent]->deadline <= t->deadline) break;
+    heap_set(c, i, c->timer_heap[parent]);
+    i = parent;
+  }
+  heap_set(c, i, t);
+}
+
+static void sift_down(cpu* c, int i) {
+  ktimer* t = c->timer_heap[i];
+  while (2 * i + 1 < c->nr_timers) {
+    int child = 2 * i + 1;
+    if (child + 1 < c->nr_timers &&
+        c->timer_heap[child + 1]->deadline < c->timer_heap[child]->deadline)
+      child++;
+    if (t->deadline <= c->timer_heap[child]->deadline) break;
+    heap_set(c, i, c->timer_heap[child]);
+    i = child;
+  }
+  heap_set(c, i, t);
+}
+
+static void heap_remove(cpu* c, int i) {
+  ktimer* last = c->timer_heap[--c->nr_timers];
+  c->timer_heap[i]->pending = 0;
+  if (i == c->nr_timers) return;
+
+  heap_set(c, i, last);
+  sift_down(c, i);
+  sift_up(c, last->index);
+}
+
+//
+// (re)start timer t on the calling hart, to call t->fn at mtime "deadline".
+//
+void timer_add(ktimer* t, uint64 deadline) {
+  cpu* c = mycpu();
+  if (t->pending) timer_del(t);
+  if (c->nr_timers == TIMER_HEAP_SIZE) panic("timer_add: too many timers.\n");
+
+  t->deadline = deadline;
+  t->pending = 1;
+  heap_set(c, c->nr_timers++, t);
+  sift_up(c, t->index);
+
+  timer_program(c);
+}
+
+//
+// cancel timer t of the calling hart, if it is pending.
+//
+void timer_del(ktimer* t) {
+  cpu* c = mycpu();
+  if (!t->pending) return;
+
+  heap_remove(c, t->index);
+  timer_program(c);
+}
+
+//
+// call the expired timers of the calling hart, and program the hardware timer for the next
+// one. called by handle_mtimer_trap() (kernel/strap.c).
+//
+void timer_run(void) {
+  cpu* c = mycpu();
+  // the timer fired (or the hart was woken up by other means). with Sstc, the interrupt stays
+  // pending until stimecmp is written again, even to stop the timer (-1): no deadline is ever
+  // 0, so that timer_program() below always writes the hardware timer.
+  c->timer_armed = 0;
+
+  c->timer_running = 1;
+  while (c->nr_timers && c->timer_heap[0]->deadline <= read_mtime()) {
+    ktimer* t = c->timer_heap[0];
+    heap_remove(c, 0);
+    // fn may add timers, including t itself.
+    t->fn(t);
+  }
+  c->timer_running = 0;
+  timer_program(c);
+}
+
+//
+// mtime ticks to nanoseconds. g_timebase (ticks per second) is defined in
+// spike_interface/spike_hart.c. split at seconds, so that the products do not overflow.
+//
+uint64 mtime_to_ns(uint64 t) {
+  return t / g_timebase * NSEC_PER_SEC + t % g_timebase * NSEC_PER_SEC / g_timebase;
+}
+
+//
+// nanoseconds to mtime ticks, rounded up so that a sleep is never shorter than asked.
+//
+uint64 ns_to_mtime(uint64 ns) {
+  return ns / NSEC_PER_SEC * g_timebase +
+         (ns % NSEC_PER_SEC * g_timebase + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+}
@@ -0,0 +1,32 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "util/types.h"
+#include "config.h"
+
+// capacity of the timer heap of a hart: the tick, plus a sleep timer for every process
+#define TIMER_HEAP_SIZE (NPROC + 8)
+
+//
+// one-shot kernel timers. each hart keeps its pending timers in a min-heap keyed by deadline
+// (in mtime ticks), and the hardware timer of the hart is programmed for the earliest one only.
+// timers are added, deleted and run on the hart owning them, with interrupts off.
+//
+typedef struct ktimer_t {
+  uint64 deadline;                 // mtime at which fn is called
+  void (*fn)(struct ktimer_t* t);  // called in handle_mtimer_trap(), on the owning hart
+  void* arg;                       // argument of fn, e.g., the sleeping process
+  int pending;                     // in the timer heap
+  int index;                       // position in the timer heap, if pending
+} ktimer;
+
+void timer_add(ktimer* t, uint64 deadline);
+void timer_del(ktimer* t);
+void timer_run(void);
+
+// conversion between mtime ticks and nanoseconds, by the timebase frequency in the DTS
+#define NSEC_PER_SEC 1000000000ULL
+uint64 mtime_to_ns(uint64 t);
+uint64 ns_to_mtime(uint64 ns);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Kernel side of the shared-memory syscall rings (see kernel/uring.h).
+ */
+
+#include "uring.h"
+#include "process.h"
+#include "syscall.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "config.h"
+#include "string.h"
+#include "spike_interface/atomic.h"
+#include "spike_interface/spike_utils.h"
+
+//
+// implement the SYS_uring_setup syscall: allocate the ring page, and map it into the address
+// space of current process at USER_URING_VA. returns the user address of the rings.
+//
+ssize_t sys_uring_setup(void) {
+  if (current->uring) return USER_URING_VA;
+
+  uring *r = alloc_page();
+  if (!r) return -1;
+  memset(r, 0, PGSIZE);
+  if (map_pages(current->pagetable, USER_URING_VA, PGSIZE, (uint64)r,
+                prot_to_type(PROT_READ | PROT_WRITE, 1)) != 0) {
+    free_page(r);
+    return -1;
+  }
+  current->uring = r;
+  return USER_URING_VA;
+}
+
+//
+// serve the requests queued in the submission ring of process p, as long as the completion
+// ring has room. called by SYS_uring_enter, and on timer ticks. returns the number of
+// requests served.
+//
+int uring_drain(process *p) {
+  uring *r = p->uring;
+  int served = 0;
+  if (!r) return 0;
+
+  // the queued syscalls run on behalf of p, but not on its ecall: they must not block it.
+  cpu *c = mycpu();
+  int may_block = c->may_block;
+  c->may_block = 0;
+
+  while (r->sq_head != r->sq_tail && r->cq_tail - r->cq_head < URING_ENTRIES) {
+    // read the request only after seeing the tail the application published.
+    mb();
+    uring_sqe sqe = r->sqes[r->sq_head & (URING_ENTRIES - 1)];
+    r->sq_head++;
+
+    long res;
+    if (sqe.sysnum == SYS_uring_setup || sqe.sysnum == SYS_uring_enter)
+      res = -1;  // rings are not nested
+    else
+      res = do_syscall(sqe.sysnum, sqe.args[0], sqe.args[1], sqe.args[2], sqe.args[3],
+                       sqe.args[4], sqe.args[5], 0);
+
+    uring_cqe *cqe = &r->cqes[r->cq_tail & (URING_ENTRIES - 1)];
+    cqe->user_data = sqe.user_data;
+    cqe->res = res;
+    // publish the completion after its content.
+    mb();
+    r->cq_tail++;
+    served++;
+  }
+  c->may_block = may_block;
+  return served;
+}
+
+//
+// implement the SYS_uring_enter syscall.
+//
+ssize_t sys_uring_enter(void) {
+  if (!current->uring) return -1;
+  return uring_drain(current);
+}
@@ -0,0 +1,44 @@
+/*
+ * Shared-memory syscall rings. An application queues syscall requests into the submission
+ * ring, and the kernel serves many of them on one trap (SYS_uring_enter or a timer tick),
+ * posting the results into the completion ring. The rings live in a page that is shared by
+ * the application and the kernel. This header is also used by user/user_lib.c.
+ */
+#ifndef _URING_H_
+#define _URING_H_
+
+#include "util/types.h"
+
+// number of entries of each ring, must be a power of 2
+#define URING_ENTRIES 32
+
+// a syscall request
+typedef struct uring_sqe_t {
+  uint64 sysnum;     // syscall number, as in kernel/syscall.h
+  uint64 args[6];    // a1 ... a6
+  uint64 user_data;  // copied to the completion, to identify the request
+} uring_sqe;
+
+// the result of a request
+typedef struct uring_cqe_t {
+  uint64 user_data;
+  int64 res;  // return value of the syscall
+} uring_cqe;
+
+// layout of the shared page. heads are advanced by consumers, tails by producers.
+typedef struct uring_t {
+  volatile uint32 sq_head;  // kernel
+  volatile uint32 sq_tail;  // application
+  volatile uint32 cq_head;  // application
+  volatile uint32 cq_tail;  // kernel
+  uring_sqe sqes[URING_ENTRIES];
+  uring_cqe cqes[URING_ENTRIES];
+} uring;
+
+// kernel side. defined in kernel/uring.c
+struct process_t;
+ssize_t sys_uring_setup(void);
+ssize_t sys_uring_enter(void);
+int uring_drain(struct process_t *p);
+
+#endif
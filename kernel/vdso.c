@@ -0,0 +1,60 @@
+/*
+ * Kernel side of the time page (see kernel/vdso.h).
+ */
+
+#include "vdso.h"
+#include "pmm.h"
+#include "riscv.h"
+#include "string.h"
+#include "spike_interface/atomic.h"
+#include "spike_interface/spike_utils.h"
+
+// the time page, mapped at USER_VDSO_VA in every process by user_vm_init() (kernel/vmm.c)
+vdso_time *g_vdso_time;
+
+// harts tick concurrently, writers of the page are serialized by this lock.
+static spinlock_t vdso_lock = SPINLOCK_INIT;
+
+//
+// allocate the time page. called by s_start() (kernel/kernel.c) before any process is created.
+//
+void vdso_init(void) {
+  g_vdso_time = alloc_page();
+  if (!g_vdso_time) panic("vdso_init: fail to allocate the time page.\n");
+  memset(g_vdso_time, 0, PGSIZE);
+  // g_timebase is defined in spike_interface/spike_hart.c
+  g_vdso_time->timebase = g_timebase;
+  g_vdso_time->mtime = read_mtime();
+}
+
+// add nr_ticks to the tick count, and take a new mtime snapshot
+static void vdso_update(uint64 nr_ticks) {
+  vdso_time *vt = g_vdso_time;
+
+  spinlock_lock(&vdso_lock);
+  atomic_set(&vt->seq, vt->seq + 1);
+  // readers see seq odd before any field changes, ...
+  asm volatile("fence w,w" ::: "memory");
+  vt->ticks += nr_ticks;
+  vt->mtime = read_mtime();
+  // ... and all the changes before seq is even again.
+  asm volatile("fence w,w" ::: "memory");
+  atomic_set(&vt->seq, vt->seq + 1);
+  spinlock_unlock(&vdso_lock);
+}
+
+//
+// count a timer tick and take a new mtime snapshot. called by tick() in kernel/strap.c
+//
+void vdso_tick(void) {
+  vdso_update(1);
+}
+
+//
+// take a new mtime snapshot before a process resumes. ticks stop while every process sleeps,
+// so the snapshot of the last tick may predate the sleep by far. called by scheduler() in
+// kernel/sched.c
+//
+void vdso_refresh(void) {
+  vdso_update(0);
+}
@@ -0,0 +1,28 @@
+/*
+ * The time page: a page of kernel data mapped read-only into every process, so that
+ * applications read the time without trapping. The kernel updates it on every timer tick
+ * and whenever a process resumes, under a seqlock: seq is odd while an update is in progress,
+ * and readers retry if it was odd or changed while they read. This header is also used by
+ * user/user_lib.c.
+ */
+#ifndef _VDSO_H_
+#define _VDSO_H_
+
+#include "util/types.h"
+
+// layout of the time page
+typedef struct vdso_time_t {
+  volatile uint32 seq;     // seqlock counter
+  uint32 pad;
+  volatile uint64 ticks;   // timer ticks of all harts since boot
+  volatile uint64 mtime;   // mtime at the last update
+  uint64 timebase;         // mtime ticks per second (timebase-frequency in the DTS)
+} vdso_time;
+
+// kernel side. defined in kernel/vdso.c
+extern vdso_time *g_vdso_time;
+void vdso_init(void);
+void vdso_tick(void);
+void vdso_refresh(void);
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * virtual address mapping related functions.
+ */
+
+#include "vmm.h"
+#include "riscv.h"
+#include "pmm.h"
+#include "config.h"
+#include "util/types.h"
+#include "util/functions.h"
+#include "string.h"
+#include "vdso.h"
+
+#include "spike_interface/spike_utils.h"
+
+/* --- utility functions for virtual address mapping --- */
+//
+// establish mapping of virtual address [va, va+size] to phyiscal address [pa, pa+size]
+// with the permission of "perm".
+//
+int map_pages(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+  uint64 first, last;
+  pte_t *pte;
+
+  for (first = ROUNDDOWN(va, PGSIZE), last = ROUNDDOWN(va + size - 1, PGSIZE);
+      first <= last; first += PGSIZE, pa += PGSIZE) {
+    if ((pte = page_walk(page_dir, first, 1)) == 0) return -1;
+    if (*pte & PTE_V)
+      panic("map_pages fails on mapping va (0x%lx) to pa (0x%lx)", first, pa);
+    *pte = PA2PTE(pa) | perm | PTE_V;
+  }
+  return 0;
+}
+
+//
+// convert permission code to permission types of PTE. leaf entries always carry the A/D
+// bits, so that the hardware never faults just to set them.
+//
+uint64 prot_to_type(int prot, int user) {
+  uint64 perm = PTE_A | PTE_D;
+  if (prot & PROT_READ) perm |= PTE_R;
+  if (prot & PROT_WRITE) perm |= PTE_W;
+  if (prot & PROT_EXEC) perm |= PTE_X;
+  if (perm == (PTE_A | PTE_D)) perm |= PTE_R;
+  if (user) perm |= PTE_U;
+  return perm;
+}
+
+//
+// traverse the page table (starting from page_dir) to find the corresponding pte of va.
+// returns: PTE (page table entry) pointing to va.
+//
+pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
+  if (va >= MAXVA) panic("page_walk");
+
+  // starting from the page directory
+  pagetable_t pt = page_dir;
+
+  // traverse from page directory to page table.
+  // as we use risc-v sv39 paging scheme, there will be 3 layers: page dir,
+  // page medium dir, and page table.
+  for (int level = 2; level > 0; level--) {
+    // macro "PX" gets the PTE index in page table of current level
+    // "pte" points to the entry of current level
+    pte_t *pte = pt + PX(level, va);
+
+    // now, we need to know if above pte is valid (established mapping to a phyiscal page)
+    // or not.
+    if (*pte & PTE_V) {  //PTE valid
+      // phisical address of pagetable of next level
+      pt = (pagetable_t)PTE2PA(*pte);
+    } else { //PTE invalid (not exist).
+      // allocate a page (to be the new pagetable), if alloc == 1
+      if( alloc && ((pt = (pte_t *)alloc_page()) != 0) ){
+        memset(pt, 0, PGSIZE);
+        // writes the physical address of newly allocated page to pte, to establish the
+        // page table tree.
+        *pte = PA2PTE(pt) | PTE_V;
+      }else //returns NULL, if alloc == 0, or no more physical page remains
+        return 0;
+    }
+  }
+
+  // return a PTE which contains phisical address of a page
+  return pt + PX(0, va);
+}
+
+//
+// look up a virtual page address, return the physical page address or 0 if not mapped.
+//
+uint64 lookup_pa(pagetable_t pagetable, uint64 va) {
+  pte_t *pte;
+  uint64 pa;
+
+  if (va >= MAXVA) return 0;
+
+  pte = page_walk(pagetable, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0 || ((*pte & PTE_R) == 0 && (*pte & PTE_W) == 0))
+    return 0;
+  pa = PTE2PA(*pte);
+
+  return pa;
+}
+
+/* --- kernel page table part --- */
+// _etext is defined in kernel.lds, it points to the address after text and rodata segments.
+extern char _etext[];
+// g_mem_size is defined in spike_interface/spike_memory.c, and is limited by pmm_init().
+extern uint64 g_mem_size;
+
+// pointer to kernel page director
+pagetable_t g_kernel_pagetable;
+
+//
+// maps virtual address [va, va+sz] to [pa, pa+sz] (for kernel).
+//
+static void kern_vm_map(pagetable_t page_dir, uint64 va, uint64 pa, uint64 sz, int perm) {
+  if (map_pages(page_dir, va, sz, pa, perm) != 0) panic("kern_vm_map");
+}
+
+//
+// kern_vm_init() constructs the kernel page table. the kernel (and all the physical memory
+// that it manages) is mapped at its physical address, i.e., virtual address = physical address.
+//
+void kern_vm_init(void) {
+  pagetable_t t_page_dir;
+
+  // allocate a page (t_page_dir) to be the page directory for kernel. alloc_page is defined in kernel/pmm.c
+  t_page_dir = (pagetable_t)alloc_page();
+  memset(t_page_dir, 0, PGSIZE);
+
+  // map virtual address [KERN_BASE, _etext] to physical address [DRAM_BASE, DRAM_BASE+(_etext - KERN_BASE)],
+  // to maintain (direct) text section kernel address mapping.
+  kern_vm_map(t_page_dir, KERN_BASE, DRAM_BASE, (uint64)_etext - KERN_BASE,
+         prot_to_type(PROT_READ | PROT_EXEC, 0));
+
+  log_debug("KERN_BASE 0x%lx\n", lookup_pa(t_page_dir, KERN_BASE));
+
+  // also (direct) map remaining address space, to make them accessable from kernel.
+  // this is important when kernel needs to access the memory content of user's app
+  // without copying pages between kernel and user spaces.
+  kern_vm_map(t_page_dir, (uint64)_etext, (uint64)_etext, DRAM_BASE + g_mem_size - (uint64)_etext,
+         prot_to_type(PROT_READ | PROT_WRITE, 0));
+
+  // the timer registers of CLINT are read (e.g., by read_mtime) in S-mode.
+  kern_vm_map(t_page_dir, CLINT, CLINT, 0x10000, prot_to_type(PROT_READ | PROT_WRITE, 0));
+
+  log_debug("physical address of _etext is: 0x%lx\n", lookup_pa(t_page_dir, (uint64)_etext));
+
+  g_kernel_pagetable = t_page_dir;
+}
+
+/* --- user page table part --- */
+// trap_sec_start points to the (page aligned) section holding smode_trap_vector, defined in
+// kernel/strap_vector.S
+extern char trap_sec_start[];
+
+//
+// prepare the address space of a user process. the trapframe and the trap vector are mapped
+// at their physical addresses (as in kernel page table), so that smode_trap_vector can switch
+// page tables while running. the stack is populated on demand.
+//
+void user_vm_init(process *p) {
+  if (map_pages(p->pagetable, (uint64)p->trapframe, PGSIZE, (uint64)p->trapframe,
+                prot_to_type(PROT_READ | PROT_WRITE, 0)) != 0 ||
+      map_pages(p->pagetable, (uint64)trap_sec_start, PGSIZE, (uint64)trap_sec_start,
+                prot_to_type(PROT_READ | PROT_EXEC, 0)) != 0)
+    panic("user_vm_init: fail to map the trap context.\n");
+
+  // the time page is shared by all processes, and read-only to them. see kernel/vdso.h
+  if (map_pages(p->pagetable, USER_VDSO_VA, PGSIZE, (uint64)g_vdso_time,
+                prot_to_type(PROT_READ, 1)) != 0)
+    panic("user_vm_init: fail to map the time page.\n");
+
+  p->nregions = 0;
+  p->heap = NULL;
+  p->heap_base = 0;
+  p->mmap_base = USER_MMAP_TOP;
+  if (user_vm_add_region(p, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, 0, 0,
+                         PROT_READ | PROT_WRITE) != 0)
+    panic("user_vm_init: fail to add the stack region.\n");
+}
+
+//
+// register a region of user address space. no memory is allocated until it is touched.
+//
+int user_vm_add_region(process *p, uint64 va, uint64 memsz, uint64 filesz, uint64 off, int prot) {
+  if (p->nregions == MAX_VM_REGIONS) return -1;
+  // user regions must not overlap the kernel, which is mapped in the user page table.
+  if (va + memsz < va || va + memsz > KERN_BASE) return -1;
+
+  vm_region *r = &p->regions[p->nregions++];
+  memset(r, 0, sizeof(vm_region));
+  r->va = va;
+  r->memsz = memsz;
+  r->filesz = filesz;
+  r->off = off;
+  r->prot = prot;
+  return 0;
+}
+
+//
+// populate the user page containing va, on a page fault of "access" (PROT_READ, PROT_WRITE
+// or PROT_EXEC) type. regions sharing the page all contribute to its content and permission.
+// returns 0 on success, -1 if the access is illegal.
+//
+int user_vm_fault(process *p, uint64 va, int access) {
+  uint64 page_va = ROUNDDOWN(va, PGSIZE);
+  int prot = PROT_NONE;
+
+  for (vm_region *r = p->regions; r < p->regions + p->nregions; r++)
+    if (page_va < r->va + r->memsz && r->va < page_va + PGSIZE) prot |= r->prot;
+  if (!(prot & access)) return -1;
+
+  // a fault on a present page is a permission violation.
+  pte_t *pte = page_walk(p->pagetable, page_va, 0);
+  if (pte && (*pte & PTE_V)) return -1;
+
+  char *pa = alloc_page();
+  if (!pa) panic("user_vm_fault: out of physical memory.\n");
+  memset(pa, 0, PGSIZE);
+
+  for (vm_region *r = p->regions; r < p->regions + p->nregions; r++) {
+    if (!(page_va < r->va + r->memsz && r->va < page_va + PGSIZE)) continue;
+    r->pages_loaded++;
+
+    // copy the part of the page that exists in the file, the rest stays zero.
+    uint64 from = MAX(page_va, r->va), to = MIN(page_va + PGSIZE, r->va + r->filesz);
+    if (from >= to) continue;
+
+    uint64 start = read_mtime();
+    if (spike_file_pread(p->elf_file, pa + (from - page_va), to - from,
+                         r->off + (from - r->va)) != to - from) {
+      free_page(pa);
+      return -1;
+    }
+    r->bytes_read += to - from;
+    r->load_ticks += read_mtime() - start;
+  }
+
+  if (map_pages(p->pagetable, page_va, PGSIZE, (uint64)pa, prot_to_type(prot, 1)) != 0) {
+    free_page(pa);
+    return -1;
+  }
+  return 0;
+}
+
+//
+// convert and return the corresponding physical address of a virtual address (va) of
+// application. returns NULL if va is not mapped.
+//
+void *user_va_to_pa(pagetable_t page_dir, void *va) {
+  uint64 pa = lookup_pa(page_dir, (uint64)va);
+  if (!pa) return NULL;
+  return (void *)(pa + ((uint64)va & (PGSIZE - 1)));
+}
+
+//
+// copy n bytes at user address va of process p into (kernel buffer) dst, populating pages
+// that have not been touched yet. returns n, or -1 if the range is not readable.
+//
+ssize_t copy_from_user(process *p, void *dst, uint64 va, size_t n) {
+  size_t copied = 0;
+  while (copied < n) {
+    uint64 cur = va + copied;
+    char *src = user_va_to_pa(p->pagetable, (void *)cur);
+    if (!src) {
+      if (user_vm_fault(p, cur, PROT_READ) != 0) return -1;
+      src = user_va_to_pa(p->pagetable, (void *)cur);
+    }
+    size_t len = MIN(n - copied, PGSIZE - (cur & (PGSIZE - 1)));
+    memcpy((char *)dst + copied, src, len);
+    copied += len;
+  }
+  return n;
+}
+
+//
+// copy n bytes of (kernel buffer) src to user address va of process p, populating pages that
+// have not been touched yet. returns n, or -1 if the range is not writable.
+//
+ssize_t copy_to_user(process *p, uint64 va, const void *src, size_t n) {
+  size_t copied = 0;
+  while (copied < n) {
+    uint64 cur = va + copied;
+    pte_t *pte = page_walk(p->pagetable, cur, 0);
+    if (!pte || !(*pte & PTE_V)) {
+      if (user_vm_fault(p, cur, PROT_WRITE) != 0) return -1;
+      pte = page_walk(p->pagetable, cur, 0);
+    }
+    if (!(*pte & PTE_W) || !(*pte & PTE_U)) return -1;
+    size_t len = MIN(n - copied, PGSIZE - (cur & (PGSIZE - 1)));
+    memcpy((char *)PTE2PA(*pte) + (cur & (PGSIZE - 1)), (const char *)src + copied, len);
+    copied += len;
+  }
+  return n;
+}
+
+//
+// free the pages of [start, end) of process p that have been populated, and unmap them.
+// start and end are page aligned.
+//
+static void user_vm_unmap(process *p, uint64 start, uint64 end) {
+  for (uint64 va = start; va < end; va += PGSIZE) {
+    pte_t *pte = page_walk(p->pagetable, va, 0);
+    if (!pte || !(*pte & PTE_V)) continue;
+    free_page((void *)PTE2PA(*pte));
+    *pte = 0;
+  }
+  flush_tlb();
+}
+
+//
+// move the program break of process p by incr bytes, creating the heap region at the first
+// call. returns the previous break, or -1 if the heap would run into the anonymous mappings
+// or below its base. the pages of a shrunk heap are freed at once; a grown heap is populated
+// on demand, as the other regions.
+//
+int64 user_vm_sbrk(process *p, int64 incr) {
+  if (!p->heap) {
+    if (user_vm_add_region(p, p->heap_base, 0, 0, 0, PROT_READ | PROT_WRITE) != 0) return -1;
+    p->heap = &p->regions[p->nregions - 1];
+  }
+
+  uint64 old_brk = p->heap->va + p->heap->memsz, new_brk = old_brk + incr;
+  if (incr < 0 ? new_brk > old_brk || new_brk < p->heap->va
+               : new_brk < old_brk || new_brk > p->mmap_base)
+    return -1;
+
+  if (new_brk < old_brk)
+    user_vm_unmap(p, ROUNDUP(new_brk, PGSIZE), ROUNDUP(old_brk, PGSIZE));
+  p->heap->memsz = new_brk - p->heap->va;
+  return old_brk;
+}
+
+//
+// map an anonymous, zero-filled region of len bytes (rounded up to pages) right below the
+// lowest mapping of process p. returns its address, or 0 if it would run into the heap.
+//
+uint64 user_vm_mmap(process *p, uint64 len, int prot) {
+  len = ROUNDUP(len, PGSIZE);
+  uint64 brk = p->heap ? p->heap->va + p->heap->memsz : p->heap_base;
+  if (len == 0 || len > p->mmap_base || p->mmap_base - len < ROUNDUP(brk, PGSIZE)) return 0;
+
+  uint64 va = p->mmap_base - len;
+  if (user_vm_add_region(p, va, len, 0, 0, prot & (PROT_READ | PROT_WRITE)) != 0) return 0;
+  p->regions[p->nregions - 1].mmapped = 1;
+  p->mmap_base = va;
+  return va;
+}
+
+//
+// unmap an anonymous region created by user_vm_mmap(). only whole regions can be unmapped.
+// the address space of a region below others is not reused until those are unmapped as well.
+// returns 0, or -1 if [va, va+len) is not such a region.
+//
+int user_vm_munmap(process *p, uint64 va, uint64 len) {
+  len = ROUNDUP(len, PGSIZE);
+  for (vm_region *r = p->regions; r < p->regions + p->nregions; r++) {
+    if (!r->mmapped || r->va != va || r->memsz != len) continue;
+
+    user_vm_unmap(p, va, va + len);
+    *r = p->regions[--p->nregions];
+    if (p->heap == &p->regions[p->nregions]) p->heap = r;
+
+    // give back the address space up to the lowest remaining mapping
+    if (va == p->mmap_base) {
+      uint64 low = USER_MMAP_TOP;
+      for (vm_region *q = p->regions; q < p->regions + p->nregions; q++)
+        if (q->mmapped && q->va < low) low = q->va;
+      p->mmap_base = low;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+//
+// print the demand loading statistics of the regions of process p.
+//
+void user_vm_report(process *p) {
+  for (vm_region *r = p->regions; r < p->regions + p->nregions; r++)
+    log_info("Region 0x%lx: %ld pages loaded on demand, %ld bytes from host, %ld mtime ticks.\n",
+           r->va, r->pages_loaded, r->bytes_read, r->load_ticks);
+}
@@ -0,0 +1,36 @@
+#ifndef _VMM_H_
+#define _VMM_H_
+
+#include "riscv.h"
+#include "process.h"
+
+// permission codes.
+enum VMPermision {
+  PROT_NONE = 0,
+  PROT_READ = 1,
+  PROT_WRITE = 2,
+  PROT_EXEC = 4,
+};
+
+uint64 prot_to_type(int prot, int user);
+pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc);
+uint64 lookup_pa(pagetable_t pagetable, uint64 va);
+int map_pages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm);
+
+// kernel page table. added @lab2_1
+extern pagetable_t g_kernel_pagetable;
+void kern_vm_init(void);
+
+// user address space
+void user_vm_init(process *p);
+int user_vm_add_region(process *p, uint64 va, uint64 memsz, uint64 filesz, uint64 off, int prot);
+int user_vm_fault(process *p, uint64 va, int access);
+void *user_va_to_pa(pagetable_t page_dir, void *va);
+ssize_t copy_from_user(process *p, void *dst, uint64 va, size_t n);
+ssize_t copy_to_user(process *p, uint64 va, const void *src, size_t n);
+int64 user_vm_sbrk(process *p, int64 incr);
+uint64 user_vm_mmap(process *p, uint64 len, int prot);
+int user_vm_munmap(process *p, uint64 va, uint64 len);
+void user_vm_report(process *p);
+
+#endif
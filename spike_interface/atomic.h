@@ -5,13 +5,32 @@
 #ifndef _RISCV_ATOMIC_H_
 #define _RISCV_ATOMIC_H_
 
-// Currently, interrupts are always disabled in M-mode.
-// todo: for PKE, wo turn on irq in lab_1_3_timer, so wo have to implement these two functions.
-#define disable_irqsave() (0)
-#define enable_irqrestore(flags) ((void)(flags))
+// the SIE (Supervisor Interrupt Enable) bit of sstatus, same as SSTATUS_SIE in kernel/riscv.h
+#define IRQ_SIE_BIT 2
 
+//
+// mask the interrupts of S-mode (clear sstatus.SIE), and return its previous value. M-mode
+// code may call it as well: interrupts are always disabled in M-mode, and sstatus is
+// accessible there.
+//
+static inline long disable_irqsave(void) {
+  long flags;
+  asm volatile("csrrci %0, sstatus, %1" : "=r"(flags) : "i"(IRQ_SIE_BIT) : "memory");
+  return flags & IRQ_SIE_BIT;
+}
+
+// restore sstatus.SIE saved by disable_irqsave()
+static inline void enable_irqrestore(long flags) {
+  if (flags & IRQ_SIE_BIT) asm volatile("csrsi sstatus, %0" ::"i"(IRQ_SIE_BIT) : "memory");
+}
+
+//
+// a ticket spinlock: lockers take tickets from "next" and are served in order, when "owner"
+// reaches their tickets. it is fair, so no hart starves under contention.
+//
 typedef struct {
-  int lock;
+  unsigned int next;   // the ticket for the next locker
+  unsigned int owner;  // the ticket being served, i.e., of the holder
   // For debugging:
   char* name;       // Name of lock.
   struct cpu* cpu;  // The cpu holding the lock.
@@ -20,46 +39,97 @@ typedef struct {
 #define SPINLOCK_INIT \
   { 0 }
 
+// waiters back off between two polls of a lock, for SPINLOCK_BACKOFF_MIN iterations at first,
+// doubling the delay up to SPINLOCK_BACKOFF_MAX, so as not to flood the bus with reads.
+#define SPINLOCK_BACKOFF_MIN 4
+#define SPINLOCK_BACKOFF_MAX 1024
+
 #define mb() asm volatile("fence" ::: "memory")
 #define atomic_set(ptr, val) (*(volatile typeof(*(ptr))*)(ptr) = val)
 #define atomic_read(ptr) (*(volatile typeof(*(ptr))*)(ptr))
 
-#define atomic_binop(ptr, inc, op)         \
-  ({                                       \
-    long flags = disable_irqsave();        \
-    typeof(*(ptr)) res = atomic_read(ptr); \
-    atomic_set(ptr, op);                   \
-    enable_irqrestore(flags);              \
-    res;                                   \
+//
+// read-modify-write operations by the AMO instructions of the A extension, on 32-bit or
+// 64-bit objects. they return the old value, and order the memory accesses around them.
+//
+#define atomic_amo(op, ptr, val)                                                 \
+  ({                                                                             \
+    typeof(*(ptr)) __res;                                                        \
+    if (sizeof(*(ptr)) == 4)                                                     \
+      asm volatile("amo" op ".w.aqrl %0, %2, %1"                                 \
+                   : "=r"(__res), "+A"(*(ptr))                                   \
+                   : "r"((long)(val))                                            \
+                   : "memory");                                                  \
+    else                                                                         \
+      asm volatile("amo" op ".d.aqrl %0, %2, %1"                                 \
+                   : "=r"(__res), "+A"(*(ptr))                                   \
+                   : "r"((long)(val))                                            \
+                   : "memory");                                                  \
+    __res;                                                                       \
   })
-#define atomic_add(ptr, inc) atomic_binop(ptr, inc, res + (inc))
-#define atomic_or(ptr, inc) atomic_binop(ptr, inc, res | (inc))
-#define atomic_swap(ptr, inc) atomic_binop(ptr, inc, (inc))
-#define atomic_cas(ptr, cmp, swp)                           \
-  ({                                                        \
-    long flags = disable_irqsave();                         \
-    typeof(*(ptr)) res = *(volatile typeof(*(ptr))*)(ptr);  \
-    if (res == (cmp)) *(volatile typeof(ptr))(ptr) = (swp); \
-    enable_irqrestore(flags);                               \
-    res;                                                    \
+#define atomic_add(ptr, inc) atomic_amo("add", ptr, inc)
+#define atomic_or(ptr, inc) atomic_amo("or", ptr, inc)
+#define atomic_swap(ptr, swp) atomic_amo("swap", ptr, swp)
+
+//
+// compare-and-swap by a lr/sc loop: stores swp to *ptr if it equals cmp. returns the old value,
+// i.e., the swap is done iff the return value equals cmp. lr.w sign-extends the loaded word,
+// so is the 32-bit cmp before comparing.
+//
+#define atomic_cas(ptr, cmp, swp)                                               \
+  ({                                                                            \
+    typeof(*(ptr)) __prev;                                                      \
+    long __fail;                                                                \
+    long __cmp = (long)(typeof(*(ptr)))(cmp);                                   \
+    long __swp = (long)(typeof(*(ptr)))(swp);                                   \
+    if (sizeof(*(ptr)) == 4)                                                    \
+      asm volatile(                                                             \
+          "1: lr.w.aqrl %0, %2\n"                                               \
+          "   bne %0, %3, 2f\n"                                                 \
+          "   sc.w.aqrl %1, %4, %2\n"                                           \
+          "   bnez %1, 1b\n"                                                    \
+          "2:"                                                                  \
+          : "=&r"(__prev), "=&r"(__fail), "+A"(*(ptr))                          \
+          : "r"((long)(int)__cmp), "r"(__swp)                                   \
+          : "memory");                                                          \
+    else                                                                        \
+      asm volatile(                                                             \
+          "1: lr.d.aqrl %0, %2\n"                                               \
+          "   bne %0, %3, 2f\n"                                                 \
+          "   sc.d.aqrl %1, %4, %2\n"                                           \
+          "   bnez %1, 1b\n"                                                    \
+          "2:"                                                                  \
+          : "=&r"(__prev), "=&r"(__fail), "+A"(*(ptr))                          \
+          : "r"(__cmp), "r"(__swp)                                              \
+          : "memory");                                                          \
+    __prev;                                                                     \
   })
 
+static inline void spinlock_backoff(unsigned int delay) {
+  for (unsigned int i = 0; i < delay; i++) asm volatile("nop");
+}
+
+// returns 0 if the lock is taken, non-zero if it is held by others.
 static inline int spinlock_trylock(spinlock_t* lock) {
-  int res = atomic_swap(&lock->lock, -1);
-  mb();
-  return res;
+  unsigned int owner = atomic_read(&lock->owner);
+  return atomic_cas(&lock->next, owner, owner + 1) != owner;
 }
 
 static inline void spinlock_lock(spinlock_t* lock) {
-  do {
-    while (atomic_read(&lock->lock))
-      ;
-  } while (spinlock_trylock(lock));
+  unsigned int ticket = atomic_add(&lock->next, 1);
+  unsigned int delay = SPINLOCK_BACKOFF_MIN;
+
+  while (atomic_read(&lock->owner) != ticket) {
+    spinlock_backoff(delay);
+    if (delay < SPINLOCK_BACKOFF_MAX) delay <<= 1;
+  }
+  mb();
 }
 
 static inline void spinlock_unlock(spinlock_t* lock) {
   mb();
-  atomic_set(&lock->lock, 0);
+  // only the holder writes owner, a plain store is enough.
+  atomic_set(&lock->owner, lock->owner + 1);
 }
 
 static inline long spinlock_lock_irqsave(spinlock_t* lock) {
@@ -0,0 +1,202 @@
+/*
+ * Block cache of host files, in guest memory. spike_file_pread() reads host files through it,
+ * BCACHE_BLOCK_SIZE bytes at a time, so that repeated small reads (e.g., of the ELF headers and
+ * symbol tables) are served without an HTIF syscall. The least recently used block is evicted
+ * when the cache is full.
+ *
+ * A reader missing the cache at the block following its last one is sequential: the cache then
+ * reads ahead of it, doubling the number of blocks read by a single host pread on every such
+ * miss, up to BCACHE_RA_MAX. A random access resets the window to one block.
+ *
+ * Blocks are keyed by the spike_file_t of the file, and dropped when the file is closed or
+ * written to.
+ */
+
+#include "spike_bcache.h"
+#include "spike_htif.h"
+#include "atomic.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+typedef struct bcache_block_t {
+  spike_file_t* f;  // NULL if the block is free
+  uint64 blkno;     // offset in the file, in blocks
+  uint32 len;       // valid bytes, less than BCACHE_BLOCK_SIZE at the end of the file
+  char* data;
+  struct bcache_block_t* hash_next;
+  // in the LRU list: most recently used first, free blocks last
+  struct bcache_block_t *lru_prev, *lru_next;
+} bcache_block;
+
+#define BCACHE_HASH_SIZE BCACHE_BLOCKS
+
+#if BCACHE_BLOCKS < BCACHE_RA_MAX
+#error "the block cache must hold a readahead window (BCACHE_RA_MAX blocks)"
+#endif
+
+static char bcache_data[BCACHE_BLOCKS][BCACHE_BLOCK_SIZE] __attribute__((aligned(BCACHE_BLOCK_SIZE)));
+// host preads of several blocks land here, before being spread to their blocks
+static char bcache_staging[BCACHE_RA_MAX * BCACHE_BLOCK_SIZE] __attribute__((aligned(BCACHE_BLOCK_SIZE)));
+
+static bcache_block bcache_blocks[BCACHE_BLOCKS];
+static bcache_block* bcache_hash[BCACHE_HASH_SIZE];
+static bcache_block *lru_head, *lru_tail;
+static int bcache_ready;
+
+static uint64 bcache_hits, bcache_misses, bcache_host_reads, bcache_readahead;
+
+// the cache is shared by all harts. a miss holds the lock while the host reads the blocks.
+static spinlock_t bcache_lock = SPINLOCK_INIT;
+
+static inline uint64 bcache_hash_of(spike_file_t* f, uint64 blkno) {
+  return ((uint64)f / sizeof(spike_file_t) * 31 + blkno) % BCACHE_HASH_SIZE;
+}
+
+static void lru_unlink(bcache_block* b) {
+  if (b->lru_prev) b->lru_prev->lru_next = b->lru_next; else lru_head = b->lru_next;
+  if (b->lru_next) b->lru_next->lru_prev = b->lru_prev; else lru_tail = b->lru_prev;
+}
+
+static void lru_push_front(bcache_block* b) {
+  b->lru_prev = NULL;
+  b->lru_next = lru_head;
+  if (lru_head) lru_head->lru_prev = b; else lru_tail = b;
+  lru_head = b;
+}
+
+static void lru_push_back(bcache_block* b) {
+  b->lru_next = NULL;
+  b->lru_prev = lru_tail;
+  if (lru_tail) lru_tail->lru_next = b; else lru_head = b;
+  lru_tail = b;
+}
+
+// all the blocks start free, on the LRU list.
+static void bcache_init(void) {
+  for (int i = 0; i < BCACHE_BLOCKS; i++) {
+    bcache_blocks[i].data = bcache_data[i];
+    lru_push_back(&bcache_blocks[i]);
+  }
+  bcache_ready = 1;
+}
+
+static bcache_block* bcache_lookup(spike_file_t* f, uint64 blkno) {
+  for (bcache_block* b = bcache_hash[bcache_hash_of(f, blkno)]; b; b = b->hash_next)
+    if (b->f == f && b->blkno == blkno) return b;
+  return NULL;
+}
+
+// remove a cached block from its hash chain, and move it to the end of the LRU list.
+static void bcache_free(bcache_block* b) {
+  bcache_block** pp = &bcache_hash[bcache_hash_of(b->f, b->blkno)];
+  while (*pp != b) pp = &(*pp)->hash_next;
+  *pp = b->hash_next;
+  b->f->bc_blocks--;
+  b->f = NULL;
+  lru_unlink(b);
+  lru_push_back(b);
+}
+
+// take the least recently used block for (f, blkno), and move it to the front of the LRU list.
+static bcache_block* bcache_alloc(spike_file_t* f, uint64 blkno) {
+  bcache_block* b = lru_tail;
+  if (b->f) bcache_free(b);
+
+  b->f = f;
+  b->blkno = blkno;
+  uint64 h = bcache_hash_of(f, blkno);
+  b->hash_next = bcache_hash[h];
+  bcache_hash[h] = b;
+  f->bc_blocks++;
+  lru_unlink(b);
+  lru_push_front(b);
+  return b;
+}
+
+//
+// read up to n blocks of f from blkno on, by a single host pread, stopping before the first
+// one that is cached already. returns the number of bytes read, or a negative error.
+//
+static ssize_t bcache_fill(spike_file_t* f, uint64 blkno, int n) {
+  for (int i = 1; i < n; i++)
+    if (bcache_lookup(f, blkno + i)) n = i;
+
+  bcache_host_reads++;
+  ssize_t ret = frontend_syscall(HTIFSYS_pread, f->kfd, (uint64)bcache_staging,
+                                 n * BCACHE_BLOCK_SIZE, blkno * BCACHE_BLOCK_SIZE, 0, 0, 0);
+  if (ret <= 0) return ret;
+
+  for (ssize_t off = 0; off < ret; off += BCACHE_BLOCK_SIZE) {
+    bcache_block* b = bcache_alloc(f, blkno + off / BCACHE_BLOCK_SIZE);
+    b->len = MIN(ret - off, BCACHE_BLOCK_SIZE);
+    memcpy(b->data, bcache_staging + off, b->len);
+  }
+  if (ret > BCACHE_BLOCK_SIZE) bcache_readahead += (ret - 1) / BCACHE_BLOCK_SIZE;
+  return ret;
+}
+
+//
+// read size bytes of f at offset into buf, through the cache. returns the number of bytes
+// read (less than size at the end of the file), or a negative error.
+//
+ssize_t bcache_pread(spike_file_t* f, void* buf, size_t size, off_t offset) {
+  size_t done = 0;
+  ssize_t err = 0;
+
+  long flags = spinlock_lock_irqsave(&bcache_lock);
+  if (!bcache_ready) bcache_init();
+
+  while (done < size) {
+    uint64 pos = offset + done;
+    uint64 blkno = pos / BCACHE_BLOCK_SIZE;
+    bcache_block* b = bcache_lookup(f, blkno);
+
+    if (b) {
+      bcache_hits++;
+      lru_unlink(b);
+      lru_push_front(b);
+    } else {
+      bcache_misses++;
+      // grow the readahead window of a sequential reader, and reset it otherwise.
+      if (blkno == f->ra_next && f->ra_window)
+        f->ra_window = MIN(f->ra_window * 2, BCACHE_RA_MAX);
+      else
+        f->ra_window = 1;
+      // the reader needs the blocks up to the end of its request anyway.
+      int n = MAX(f->ra_window, (offset + size - 1) / BCACHE_BLOCK_SIZE - blkno + 1);
+      if ((err = bcache_fill(f, blkno, MIN(n, BCACHE_RA_MAX))) <= 0) break;
+      b = bcache_lookup(f, blkno);
+    }
+    f->ra_next = blkno + 1;
+
+    uint32 boff = pos % BCACHE_BLOCK_SIZE;
+    if (boff >= b->len) break;  // end of file
+    size_t len = MIN(size - done, b->len - boff);
+    memcpy((char*)buf + done, b->data + boff, len);
+    done += len;
+    if (b->len < BCACHE_BLOCK_SIZE && boff + len == b->len) break;  // end of file
+  }
+  spinlock_unlock_irqrestore(&bcache_lock, flags);
+
+  return done ? done : err;
+}
+
+//
+// drop the cached blocks of f, e.g., when it is closed (its spike_file_t may then be reused
+// by another file) or written to.
+//
+void bcache_invalidate(spike_file_t* f) {
+  if (!atomic_read(&f->bc_blocks)) return;
+
+  long flags = spinlock_lock_irqsave(&bcache_lock);
+  for (int i = 0; i < BCACHE_BLOCKS && f->bc_blocks; i++)
+    if (bcache_blocks[i].f == f) bcache_free(&bcache_blocks[i]);
+  f->ra_next = f->ra_window = 0;
+  spinlock_unlock_irqrestore(&bcache_lock, flags);
+}
+
+void bcache_report(void) {
+  log_info("bcache: %ld hits, %ld misses, %ld host reads, %ld blocks read ahead\n", bcache_hits,
+           bcache_misses, bcache_host_reads, bcache_readahead);
+}
@@ -0,0 +1,23 @@
+#ifndef _SPIKE_BCACHE_H_
+#define _SPIKE_BCACHE_H_
+
+#include "util/types.h"
+#include "spike_file.h"
+
+// size of a cached block of a host file
+#define BCACHE_BLOCK_SIZE 4096
+
+// memory budget of the block cache, in blocks. set at build time, e.g.,
+// "make BCACHE_BLOCKS=256" (see Makefile).
+#ifndef BCACHE_BLOCKS
+#define BCACHE_BLOCKS 64
+#endif
+
+// maximum number of blocks a sequential reader reads ahead of its position
+#define BCACHE_RA_MAX 8
+
+ssize_t bcache_pread(spike_file_t* f, void* buf, size_t size, off_t offset);
+void bcache_invalidate(spike_file_t* f);
+void bcache_report(void);
+
+#endif
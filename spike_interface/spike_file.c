@@ -8,17 +8,57 @@
 
 #include "spike_file.h"
 #include "spike_htif.h"
+#include "spike_bcache.h"
 #include "atomic.h"
 #include "string.h"
 #include "util/functions.h"
 #include "spike_interface/spike_utils.h"
 //#include "../kernel/config.h"
 
-#define MAX_FILES 128
-#define MAX_FDS 128
 static spike_file_t* spike_fds[MAX_FDS];
 spike_file_t spike_files[MAX_FILES] = {[0 ... MAX_FILES - 1] = {-1, 0}};
 
+//
+// free slots of spike_files and spike_fds are kept in lock-free stacks of indices (Treiber
+// stacks), so that open, dup and close take constant time. head holds the top index plus 1
+// (0 if the stack is empty) in its low half, and a tag in its high half: the tag changes on
+// every push and pop, so that a pop does not succeed on a head that was popped and pushed
+// again meanwhile (the ABA problem).
+//
+typedef struct index_stack_t {
+  uint64 head;
+  uint32* next;  // next[i]: the index below i plus 1, while i is in the stack
+} index_stack;
+
+static uint32 free_file_next[MAX_FILES], free_fd_next[MAX_FDS];
+static index_stack free_files = {0, free_file_next};
+static index_stack free_fds = {0, free_fd_next};
+
+#define INDEX_STACK_TAG(head) ((((head) >> 32) + 1) << 32)
+
+static void index_stack_push(index_stack* s, uint32 i) {
+  uint64 old, new;
+  do {
+    old = atomic_read(&s->head);
+    s->next[i] = (uint32)old;
+    new = INDEX_STACK_TAG(old) | (i + 1);
+  } while (atomic_cas(&s->head, old, new) != old);
+}
+
+// returns the popped index, or -1 if the stack is empty.
+static long index_stack_pop(index_stack* s) {
+  uint64 old, new;
+  do {
+    old = atomic_read(&s->head);
+    uint32 top = (uint32)old;
+    if (!top) return -1;
+    // next[top - 1] may be stale if top is popped by another hart meanwhile, the cas then
+    // fails as the tag has changed.
+    new = INDEX_STACK_TAG(old) | atomic_read(&s->next[top - 1]);
+  } while (atomic_cas(&s->head, old, new) != old);
+  return (uint32)old - 1;
+}
+
 void copy_stat(struct stat* dest_va, struct frontend_stat* src) {
   struct stat* dest = (struct stat*)dest_va;
   dest->st_dev = src->dev;
@@ -46,18 +86,35 @@ int spike_file_stat(spike_file_t* f, struct stat* s) {
 
 int spike_file_close(spike_file_t* f) {
   if (!f) return -1;
-  spike_file_t* old = atomic_cas(&spike_fds[f->kfd], f, 0);
+  // f may be reused once released, read its fd before.
+  int fd = f->kfd;
+  spike_file_t* old = NULL;
+  if (fd >= 0 && fd < MAX_FDS) old = atomic_cas(&spike_fds[fd], f, 0);
   spike_file_decref(f);
   if (old != f) return -1;
+  index_stack_push(&free_fds, fd);
   spike_file_decref(f);
   return 0;
 }
 
+//
+// release a file the kernel opened for itself by spike_file_open(), i.e., that has no
+// descriptor: drop both the reference of the opener and the initial one, which releases f.
+//
+void spike_file_put(spike_file_t* f) {
+  if (!f) return;
+  spike_file_decref(f);
+  spike_file_decref(f);
+}
+
 void spike_file_decref(spike_file_t* f) {
   if (atomic_add(&f->refcnt, -1) == 2) {
     int kfd = f->kfd;
+    // the slot of f may be reused by another file as soon as refcnt drops to 0.
+    bcache_invalidate(f);
     mb();
     atomic_set(&f->refcnt, 0);
+    index_stack_push(&free_files, f - spike_files);
 
     frontend_syscall(HTIFSYS_close, kfd, 0, 0, 0, 0, 0, 0);
   }
@@ -69,27 +126,30 @@ void spike_file_incref(spike_file_t* f) {
 }
 
 ssize_t spike_file_write(spike_file_t* f, const void* buf, size_t size) {
+  bcache_invalidate(f);
   return frontend_syscall(HTIFSYS_write, f->kfd, (uint64)buf, size, 0, 0, 0, 0);
 }
 
 static spike_file_t* spike_file_get_free(void) {
-  for (spike_file_t* f = spike_files; f < spike_files + MAX_FILES; f++)
-    if (atomic_read(&f->refcnt) == 0 && atomic_cas(&f->refcnt, 0, INIT_FILE_REF) == 0)
-      return f;
-  return NULL;
+  long i = index_stack_pop(&free_files);
+  if (i < 0) return NULL;
+  atomic_set(&spike_files[i].refcnt, INIT_FILE_REF);
+  return &spike_files[i];
 }
 
 int spike_file_dup(spike_file_t* f) {
-  for (int i = 0; i < MAX_FDS; i++) {
-    if (atomic_cas(&spike_fds[i], 0, f) == 0) {
-      spike_file_incref(f);
-      return i;
-    }
-  }
-  return -1;
+  long fd = index_stack_pop(&free_fds);
+  if (fd < 0) return -1;
+  atomic_set(&spike_fds[fd], f);
+  spike_file_incref(f);
+  return fd;
 }
 
 void spike_file_init(void) {
+  // all slots are free. push them in reverse order, so that the lowest ones are used first.
+  for (long i = MAX_FILES - 1; i >= 0; i--) index_stack_push(&free_files, i);
+  for (long i = MAX_FDS - 1; i >= 0; i--) index_stack_push(&free_fds, i);
+
   // create stdin, stdout, stderr and FDs 0-2
   for (int i = 0; i < 3; i++) {
     spike_file_t* f = spike_file_get_free();
@@ -117,8 +177,9 @@ spike_file_t* spike_file_open(const char* fn, int flags, int mode) {
   return spike_file_openat(AT_FDCWD, fn, flags, mode);
 }
 
+// served by the block cache, see spike_interface/spike_bcache.c
 ssize_t spike_file_pread(spike_file_t* f, void* buf, size_t size, off_t offset) {
-  return frontend_syscall(HTIFSYS_pread, f->kfd, (uint64)buf, size, offset, 0, 0, 0);
+  return bcache_pread(f, buf, size, offset);
 }
 
 ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size) {
@@ -9,13 +9,29 @@
 typedef struct file {
   int kfd;  // file descriptor of the host file
   uint32 refcnt;
+  // state of the block cache (spike_interface/spike_bcache.c): number of cached blocks, the
+  // block following the last one read, and the current readahead window
+  uint32 bc_blocks;
+  uint64 ra_next;
+  uint32 ra_window;
 } spike_file_t;
 
+// sizes of the tables of files and descriptors, set at build time, e.g.,
+// "make MAX_FILES=4096 MAX_FDS=4096" (see Makefile).
+#ifndef MAX_FILES
+#define MAX_FILES 128
+#endif
+#ifndef MAX_FDS
+#define MAX_FDS 128
+#endif
+
 extern spike_file_t spike_files[];
 
 #define O_RDONLY 00
 #define O_WRONLY 01
 #define O_RDWR 02
+#define O_CREAT 0100
+#define O_TRUNC 01000
 #define ENOMEM 12 /* Out of memory */
 
 #define stdin (spike_files + 0)
@@ -50,6 +66,7 @@ struct frontend_stat {
 void copy_stat(struct stat* dest, struct frontend_stat* src);
 spike_file_t* spike_file_open(const char* fn, int flags, int mode);
 int spike_file_close(spike_file_t* f);
+void spike_file_put(spike_file_t* f);
 spike_file_t* spike_file_openat(int dirfd, const char* fn, int flags, int mode);
 ssize_t spike_file_lseek(spike_file_t* f, size_t ptr, int dir);
 ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size);
@@ -0,0 +1,95 @@
+/*
+ * scanning the harts (cpus) from the DTS (Device Tree String).
+ * output: the number of harts (stored in "uint64 g_num_harts"), the timebase frequency of
+ * mtime (stored in "uint64 g_timebase"), and whether the harts support Sstc (stored in
+ * "uint64 g_sstc").
+ *
+ * codes are adapted from riscv-pk (https://github.com/riscv/riscv-pk)
+ */
+#include "dts_parse.h"
+#include "spike_interface/spike_utils.h"
+#include "string.h"
+
+uint64 g_num_harts;
+uint64 g_timebase;
+uint64 g_sstc;
+
+// number of harts whose isa strings list sstc
+static uint64 sstc_harts;
+
+struct hart_scan {
+  int cpu;
+  int hart;
+  int sstc;
+};
+
+// DTS cells are big-endian
+static uint32 read_cell(const uint32 *value) {
+  const uint8 *b = (const uint8 *)value;
+  return (uint32)b[0] << 24 | (uint32)b[1] << 16 | (uint32)b[2] << 8 | b[3];
+}
+
+//
+// whether the isa string (e.g., "rv64imafdc_zicntr_sstc") lists the multi-letter extension
+// ext. such extensions follow the single-letter ones, separated by underscores.
+//
+static int isa_has_extension(const char *isa, const char *ext) {
+  for (; *isa; isa++) {
+    if (*isa != '_') continue;
+    const char *s = isa + 1, *e = ext;
+    for (; *e && *s == *e; s++, e++)
+      ;
+    if (!*e && (!*s || *s == '_')) return 1;
+  }
+  return 0;
+}
+
+static void hart_open(const struct fdt_scan_node *node, void *extra) {
+  struct hart_scan *scan = (struct hart_scan *)extra;
+  memset(scan, 0, sizeof(*scan));
+  scan->hart = -1;
+}
+
+static void hart_prop(const struct fdt_scan_prop *prop, void *extra) {
+  struct hart_scan *scan = (struct hart_scan *)extra;
+  if (!strcmp(prop->name, "device_type") && !strcmp((const char *)prop->value, "cpu")) {
+    scan->cpu = 1;
+  } else if (!strcmp(prop->name, "reg")) {
+    uint64 reg;
+    fdt_get_address(prop->node->parent, prop->value, &reg);
+    scan->hart = reg;
+  } else if (!strcmp(prop->name, "riscv,isa")) {
+    scan->sstc = isa_has_extension((const char *)prop->value, "sstc");
+  } else if (!strcmp(prop->name, "timebase-frequency")) {
+    // found in the "cpus" node, or in every "cpu" node
+    g_timebase = read_cell(prop->value);
+  }
+}
+
+static void hart_done(const struct fdt_scan_node *node, void *extra) {
+  struct hart_scan *scan = (struct hart_scan *)extra;
+  if (!scan->cpu || scan->hart < 0) return;
+
+  // hart ids are numbered from 0 by Spike
+  if (scan->hart + 1 > g_num_harts) g_num_harts = scan->hart + 1;
+  if (scan->sstc) sstc_harts++;
+}
+
+// scanning the harts
+void query_harts(uint64 fdt) {
+  struct fdt_cb cb;
+  struct hart_scan scan;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.open = hart_open;
+  cb.prop = hart_prop;
+  cb.done = hart_done;
+  cb.extra = &scan;
+
+  g_num_harts = 0;
+  g_timebase = 0;
+  sstc_harts = 0;
+  fdt_scan(fdt, &cb);
+  assert(g_num_harts > 0 && g_timebase > 0);
+  g_sstc = sstc_harts == g_num_harts;
+}
@@ -0,0 +1,14 @@
+#ifndef _SPIKE_HART_H_
+#define _SPIKE_HART_H_
+
+#include "util/types.h"
+
+// number of harts (cpus), and the frequency (in Hz) of mtime, found in the DTS
+extern uint64 g_num_harts;
+extern uint64 g_timebase;
+// all the harts support the Sstc extension (stimecmp), by their "riscv,isa" strings
+extern uint64 g_sstc;
+
+void query_harts(uint64 fdt);
+
+#endif
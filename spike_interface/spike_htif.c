@@ -70,14 +70,28 @@ extern uint64_t __htif_base;
 #define FROMHOST_OFFSET ((uint64)fromhost - (uint64)__htif_base)
 
 volatile int htif_console_buf;
+// serializes the accesses to tohost/fromhost and to the request queue below. taken with the
+// interrupts masked, as the timer handler writes the console as well.
 static spinlock_t htif_lock = SPINLOCK_INIT;
 
+// syscall requests to the host. the acknowledgement in fromhost does not tell which request
+// completed, so one request is sent at a time, and the others wait in a FIFO queue.
+static htif_req *htif_inflight;    // sent to the host, not yet completed
+static int htif_inflight_done;     // the host has acknowledged htif_inflight
+static htif_req *htif_queue_head, *htif_queue_tail;
+
 static void __check_fromhost(void) {
   uint64_t fh = fromhost;
   if (!fh) return;
   fromhost = 0;
 
-  // this should be from the console
+  // the syscall device acknowledges the request in flight, completed by htif_poll().
+  if (FROMHOST_DEV(fh) == 0) {
+    htif_inflight_done = 1;
+    return;
+  }
+
+  // otherwise, this should be from the console
   assert(FROMHOST_DEV(fh) == 1);
   switch (FROMHOST_CMD(fh)) {
     case 0:
@@ -95,40 +109,86 @@ static void __set_tohost(uint64 dev, uint64 cmd, uint64 data) {
   tohost = TOHOST_CMD(dev, cmd, data);
 }
 
-static void do_tohost_fromhost(uint64 dev, uint64 cmd, uint64 data) {
-  spinlock_lock(&htif_lock);
-  __set_tohost(dev, cmd, data);
+// send the request at the head of the queue, if none is in flight. htif_lock is held.
+static void __start_next_request(void) {
+  if (htif_inflight || !htif_queue_head) return;
+  htif_inflight = htif_queue_head;
+  htif_queue_head = htif_queue_head->next;
+  if (!htif_queue_head) htif_queue_tail = NULL;
+  __set_tohost(0, 0, (uint64)htif_inflight->magic_mem);
+}
 
-  while (1) {
-    uint64_t fh = fromhost;
-    if (fh) {
-      if (FROMHOST_DEV(fh) == dev && FROMHOST_CMD(fh) == cmd) {
-        fromhost = 0;
-        break;
-      }
-      __check_fromhost();
-    }
+/////////////////////    Encapsulated Spike HTIF functionalities    //////////////////
+//
+// queue a syscall request to the host, whose arguments are in req->magic_mem. it completes
+// asynchronously, in a later htif_poll() (on any hart).
+//
+void htif_submit(htif_req *req) {
+  req->done = 0;
+  req->next = NULL;
+
+  long flags = spinlock_lock_irqsave(&htif_lock);
+  if (htif_queue_tail)
+    htif_queue_tail->next = req;
+  else
+    htif_queue_head = req;
+  htif_queue_tail = req;
+  __start_next_request();
+  spinlock_unlock_irqrestore(&htif_lock, flags);
+}
+
+// are there requests in flight or queued? the host raises no interrupt when it completes one.
+int htif_busy(void) { return atomic_read(&htif_inflight) != NULL; }
+
+//
+// check whether the host has completed the request in flight. if so, send the next one, mark
+// the completed one done (its result is in magic_mem[0]) and call its fn. returns 1 if a
+// request has completed, 0 otherwise.
+//
+int htif_poll(void) {
+  if (!htif_busy()) return 0;
+
+  htif_req *req = NULL;
+  long flags = spinlock_lock_irqsave(&htif_lock);
+  __check_fromhost();
+  if (htif_inflight_done) {
+    req = htif_inflight;
+    htif_inflight = NULL;
+    htif_inflight_done = 0;
+    __start_next_request();
   }
-  spinlock_unlock(&htif_lock);
+  spinlock_unlock_irqrestore(&htif_lock, flags);
+  if (!req) return 0;
+
+  // the owner of a request without fn may release it as soon as it is done.
+  void (*fn)(htif_req *) = req->fn;
+  mb();
+  atomic_set(&req->done, 1);
+  if (fn) fn(req);
+  return 1;
 }
 
-/////////////////////    Encapsulated Spike HTIF functionalities    //////////////////
-void htif_syscall(uint64 arg) { do_tohost_fromhost(0, 0, arg); }
+// submit a request, and wait for its completion.
+void htif_syscall(htif_req *req) {
+  req->fn = NULL;
+  htif_submit(req);
+  while (!atomic_read(&req->done)) htif_poll();
+}
 
 // htif fuctionalities
 void htif_console_putchar(uint8_t ch) {
 #if __riscv_xlen == 32
   // HTIF devices are not supported on RV32, so proxy a write system call
-  volatile uint64_t magic_mem[8];
-  magic_mem[0] = HTIFSYS_write;
-  magic_mem[1] = 1;
-  magic_mem[2] = (uint64)&ch;
-  magic_mem[3] = 1;
-  do_tohost_fromhost(0, 0, (uint64)magic_mem);
+  htif_req req;
+  req.magic_mem[0] = HTIFSYS_write;
+  req.magic_mem[1] = 1;
+  req.magic_mem[2] = (uint64)&ch;
+  req.magic_mem[3] = 1;
+  htif_syscall(&req);
 #else
-  spinlock_lock(&htif_lock);
+  long flags = spinlock_lock_irqsave(&htif_lock);
   __set_tohost(1, 1, ch);
-  spinlock_unlock(&htif_lock);
+  spinlock_unlock_irqrestore(&htif_lock, flags);
 #endif
 }
 
@@ -138,14 +198,14 @@ int htif_console_getchar(void) {
   return -1;
 #endif
 
-  spinlock_lock(&htif_lock);
+  long flags = spinlock_lock_irqsave(&htif_lock);
   __check_fromhost();
   int ch = htif_console_buf;
   if (ch >= 0) {
     htif_console_buf = -1;
     __set_tohost(1, 0, 0);
   }
-  spinlock_unlock(&htif_lock);
+  spinlock_unlock_irqrestore(&htif_lock, flags);
 
   return ch - 1;
 }
@@ -94,8 +94,21 @@
 extern uint64 htif;
 void query_htif(uint64 dtb);
 
+// a syscall request to the host. magic_mem holds the syscall number and arguments, and then
+// the return value in magic_mem[0]. the request must stay in memory until it is done.
+typedef struct htif_req_t {
+  volatile uint64 magic_mem[8];
+  volatile int done;
+  void (*fn)(struct htif_req_t *req);  // called by htif_poll() on completion, may be NULL
+  void *arg;                           // for fn
+  struct htif_req_t *next;             // in the queue of spike_interface/spike_htif.c
+} htif_req;
+
 // Spike HTIF functionalities
-void htif_syscall(uint64);
+void htif_submit(htif_req *req);
+int htif_poll(void);
+int htif_busy(void);
+void htif_syscall(htif_req *req);
 
 void htif_console_putchar(uint8_t);
 int htif_console_getchar();
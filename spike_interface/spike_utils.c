@@ -12,28 +12,29 @@
 #include "spike_file.h"
 
 //=============    encapsulating htif syscalls, invoking Spike functions    =============
+//
+// fill a host syscall request, to be passed to htif_submit() (spike_interface/spike_htif.c).
+//
+void frontend_req_init(htif_req* req, long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3,
+                       uint64 a4, uint64 a5, uint64 a6) {
+  req->magic_mem[0] = n;
+  req->magic_mem[1] = a0;
+  req->magic_mem[2] = a1;
+  req->magic_mem[3] = a2;
+  req->magic_mem[4] = a3;
+  req->magic_mem[5] = a4;
+  req->magic_mem[6] = a5;
+  req->magic_mem[7] = a6;
+}
+
 long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4,
       uint64 a5, uint64 a6) {
-  static volatile uint64 magic_mem[8];
-
-  static spinlock_t lock = SPINLOCK_INIT;
-  spinlock_lock(&lock);
-
-  magic_mem[0] = n;
-  magic_mem[1] = a0;
-  magic_mem[2] = a1;
-  magic_mem[3] = a2;
-  magic_mem[4] = a3;
-  magic_mem[5] = a4;
-  magic_mem[6] = a5;
-  magic_mem[7] = a6;
-
-  htif_syscall((uintptr_t)magic_mem);
-
-  long ret = magic_mem[0];
-
-  spinlock_unlock(&lock);
-  return ret;
+  // the request lives on the stack of the caller, so that harts do not wait for each other
+  // but in the queue of host requests.
+  htif_req req;
+  frontend_req_init(&req, n, a0, a1, a2, a3, a4, a5, a6);
+  htif_syscall(&req);
+  return req.magic_mem[0];
 }
 
 //===============    Spike-assisted printf, output string to terminal    ===============
@@ -44,11 +45,58 @@ static uintptr_t mcall_console_putchar(uint8 ch) {
   return 0;
 }
 
-void vprintk(const char* s, va_list vl) {
-  char out[256];
-  int res = vsnprintf(out, sizeof(out), s, vl);
+//
+// kernel messages are appended to console_buf, and written to the host (stderr) with one
+// HTIF call when the buffer fills up, after CONSOLE_FLUSH_LINES lines, CONSOLE_FLUSH_TICKS
+// timer ticks after the oldest pending message, or at shutdown (including panics).
+//
+static char console_buf[CONSOLE_BUF_SIZE];
+static size_t console_len, console_lines, console_age;
+static spinlock_t console_lock = SPINLOCK_INIT;
+
+static void __console_flush(void) {
   //you need spike_file_init before this call
-  spike_file_write(stderr, out, res < sizeof(out) ? res : sizeof(out));
+  if (console_len) spike_file_write(stderr, console_buf, console_len);
+  console_len = console_lines = console_age = 0;
+}
+
+void console_flush(void) {
+  long flags = spinlock_lock_irqsave(&console_lock);
+  __console_flush();
+  spinlock_unlock_irqrestore(&console_lock, flags);
+}
+
+// called on each timer tick, to bound the time a message stays in the buffer.
+void console_tick(void) {
+  long flags = spinlock_lock_irqsave(&console_lock);
+  if (console_len && ++console_age >= CONSOLE_FLUSH_TICKS) __console_flush();
+  spinlock_unlock_irqrestore(&console_lock, flags);
+}
+
+void vprintk(const char* s, va_list vl) {
+  long flags = spinlock_lock_irqsave(&console_lock);
+  va_list vc;
+  va_copy(vc, vl);
+
+  size_t room = CONSOLE_BUF_SIZE - console_len;
+  size_t res = vsnprintf(console_buf + console_len, room, s, vl);
+  if (res >= room && console_len) {
+    // the message does not fit in, write out the pending ones and format it again.
+    __console_flush();
+    room = CONSOLE_BUF_SIZE;
+    res = vsnprintf(console_buf, room, s, vc);
+  }
+  va_end(vc);
+
+  // a message longer than the whole buffer is truncated.
+  size_t len = MIN(res, room - 1);
+  for (const char* p = console_buf + console_len; p < console_buf + console_len + len; p++)
+    if (*p == '\n') console_lines++;
+  console_len += len;
+
+  if (console_lines >= CONSOLE_FLUSH_LINES || console_len == CONSOLE_BUF_SIZE - 1)
+    __console_flush();
+  spinlock_unlock_irqrestore(&console_lock, flags);
 }
 
 void printk(const char* s, ...) {
@@ -79,10 +127,23 @@ void sprint(const char* s, ...) {
   va_end(vl);
 }
 
+//===============    leveled kernel logging, see spike_utils.h    ===============
+uint32 g_log_mask = ~0U;
+
+void log_printk(int level, const char* s, ...) {
+  va_list vl;
+  va_start(vl, s);
+
+  vprintk(s, vl);
+
+  va_end(vl);
+}
+
 //===============    Spike-assisted termination, panic and assert    ===============
 void poweroff(uint16_t code) {
   assert(htif);
   sprint("Power off\r\n");
+  console_flush();
   if (htif) {
     htif_poweroff();
   } else {
@@ -96,6 +157,7 @@ void poweroff(uint16_t code) {
 
 void shutdown(int code) {
   sprint("System is shutting down with exit code %d.\n", code);
+  console_flush();
   frontend_syscall(HTIFSYS_exit, code, 0, 0, 0, 0, 0, 0);
   while (1)
     ;
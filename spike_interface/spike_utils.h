@@ -4,16 +4,73 @@
 #include "util/types.h"
 #include "spike_file.h"
 #include "spike_memory.h"
+#include "spike_hart.h"
 #include "spike_htif.h"
 
+// kernel console buffering. see vprintk() in spike_interface/spike_utils.c
+#define CONSOLE_BUF_SIZE 4096
+#define CONSOLE_FLUSH_LINES 32
+#define CONSOLE_FLUSH_TICKS 2
+
+void frontend_req_init(htif_req* req, long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3,
+                       uint64 a4, uint64 a5, uint64 a6);
 long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
                       uint64 a6);
 
 void poweroff(uint16 code) __attribute((noreturn));
 void sprint(const char* s, ...);
+void log_printk(int level, const char* s, ...);
 void putstring(const char* s);
+void console_flush(void);
+void console_tick(void);
 void shutdown(int) __attribute__((noreturn));
 
+// levels of kernel logging. messages of levels above LOG_LEVEL (set at build time, see
+// Makefile) compile to nothing, and g_log_mask filters the rest at run time.
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+#define LOG_TRACE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+// bit (1 << level) enables the messages of that level. all levels are enabled initially.
+extern uint32 g_log_mask;
+
+#define klog(level, s, ...)                                              \
+  do {                                                                   \
+    if (g_log_mask & (1U << (level))) log_printk(level, s, ##__VA_ARGS__); \
+  } while (0)
+
+#define log_error(s, ...) klog(LOG_ERROR, s, ##__VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_WARN
+#define log_warn(s, ...) klog(LOG_WARN, s, ##__VA_ARGS__)
+#else
+#define log_warn(s, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_INFO
+#define log_info(s, ...) klog(LOG_INFO, s, ##__VA_ARGS__)
+#else
+#define log_info(s, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_DEBUG
+#define log_debug(s, ...) klog(LOG_DEBUG, s, ##__VA_ARGS__)
+#else
+#define log_debug(s, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_TRACE
+#define log_trace(s, ...) klog(LOG_TRACE, s, ##__VA_ARGS__)
+#else
+#define log_trace(s, ...) do {} while (0)
+#endif
+
 #define assert(x)                              \
   ({                                           \
     if (!(x)) die("assertion failed: %s", #x); \
@@ -0,0 +1,138 @@
+/*
+ * Below is the given application for the heap allocator of user_lib (user/user_malloc.c): it
+ * replays alloc-heavy traces on it and on a naive first-fit allocator, and compares their
+ * costs (in cycles per operation).
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+
+// operations of a trace, and the number of blocks live at once
+#define NR_OPS 20000
+#define NR_SLOTS 512
+// the arena of the first-fit allocator
+#define ARENA_SIZE (4 * 1024 * 1024)
+
+static inline uint64 rdcycle(void) {
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r"(x));
+  return x;
+}
+
+//
+// the naive allocator: an implicit list of all the blocks of the arena, each with an 8-byte
+// header (size | used), searched from the start for the first free block that fits. a freed
+// block is merged with the free blocks after it.
+//
+static char *arena, *arena_end;
+
+static void ff_init(void) {
+  arena = mmap(ARENA_SIZE, PROT_READ | PROT_WRITE);
+  if (arena == (char *)-1) {
+    printu("malloc_bench: fail to map the arena.\n");
+    exit(-1);
+  }
+  // a single free block, with its payload 16-byte aligned
+  arena += 8;
+  arena_end = arena + ARENA_SIZE - 16;
+  *(uint64 *)arena = ARENA_SIZE - 16;
+}
+
+static void *ff_malloc(uint64 size) {
+  uint64 need = (size + 8 + 15) & ~15UL;
+  for (char *b = arena; b < arena_end; b += *(uint64 *)b & ~1UL) {
+    uint64 head = *(uint64 *)b;
+    if ((head & 1) || head < need) continue;
+    if (head - need >= 32) {
+      *(uint64 *)(b + need) = head - need;
+      head = need;
+    }
+    *(uint64 *)b = head | 1;
+    return b + 8;
+  }
+  return NULL;
+}
+
+static void ff_free(void *p) {
+  char *b = (char *)p - 8;
+  uint64 size = *(uint64 *)b & ~1UL;
+  while (b + size < arena_end && !(*(uint64 *)(b + size) & 1)) size += *(uint64 *)(b + size);
+  *(uint64 *)b = size;
+}
+
+//
+// a trace: NR_OPS operations on NR_SLOTS slots, freeing the block of a random slot if it has
+// one, or allocating one of a random size in [min, max) otherwise. the same seed gives the
+// same trace to both allocators.
+//
+typedef struct trace_t {
+  const char *name;
+  uint64 min, max;
+  // allocate every block of a round before freeing them all, instead of random slots
+  int rounds;
+} trace;
+
+static trace traces[] = {
+  {"small, random", 16, 256, 0},
+  {"mixed, random", 16, 4096, 0},
+  {"small, rounds", 16, 256, 1},
+  {"large, random", 1024, 8192, 0},
+};
+
+static uint64 seed;
+
+static uint64 next_rand(void) {
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return seed >> 33;
+}
+
+static void *slots[NR_SLOTS];
+
+// replay trace t, returns the cycles per operation, and counts the failed and corrupted blocks
+static uint64 replay(trace *t, void *(*alloc)(uint64), void (*release)(void *), int *errors) {
+  seed = 42;
+  *errors = 0;
+  uint64 start = rdcycle();
+
+  for (int i = 0; i < NR_OPS; i++) {
+    int s = t->rounds ? i % NR_SLOTS : next_rand() % NR_SLOTS;
+    if (slots[s] && (!t->rounds || i / NR_SLOTS % 2)) {
+      if (*(uint64 *)slots[s] != (uint64)s) (*errors)++;
+      release(slots[s]);
+      slots[s] = NULL;
+    } else if (!slots[s]) {
+      uint64 size = t->min + next_rand() % (t->max - t->min);
+      if (!(slots[s] = alloc(size))) {
+        (*errors)++;
+        continue;
+      }
+      // tag the block, checked when it is freed
+      *(uint64 *)slots[s] = s;
+    }
+  }
+
+  uint64 cycles = rdcycle() - start;
+  for (int s = 0; s < NR_SLOTS; s++) {
+    if (slots[s]) release(slots[s]);
+    slots[s] = NULL;
+  }
+  return cycles / NR_OPS;
+}
+
+int main(void) {
+  ff_init();
+
+  for (int i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+    int err_malloc, err_ff;
+    uint64 fast = replay(&traces[i], malloc, free, &err_malloc);
+    uint64 naive = replay(&traces[i], ff_malloc, ff_free, &err_ff);
+    printu("trace %s: malloc %ld cycles per op, first-fit %ld cycles per op\n", traces[i].name,
+           fast, naive);
+    if (err_malloc || err_ff)
+      printu("trace %s: %d errors with malloc, %d with first-fit\n", traces[i].name, err_malloc,
+             err_ff);
+  }
+
+  exit(0);
+  return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Below is the given application for the fast syscall path: it measures the cost (in cycles) of
+ * a syscall that does nothing, served by the fast trap path and by the slow one.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+#include "kernel/syscall.h"
+
+// number of calls to time for each path
+#define NR_CALLS 10000
+
+static inline uint64 rdcycle(void) {
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r"(x));
+  return x;
+}
+
+static uint64 bench(uint64 sysnum) {
+  uint64 start = rdcycle();
+  for (int i = 0; i < NR_CALLS; i++) do_user_call(sysnum, 0, 0, 0, 0, 0, 0, 0);
+  return (rdcycle() - start) / NR_CALLS;
+}
+
+int main(void) {
+  // warm up the caches and the TLB
+  bench(SYS_user_null);
+
+  uint64 fast = bench(SYS_user_null);
+  uint64 slow = bench(SYS_user_null_slow);
+  printu("null syscall, fast path: %ld cycles per call\n", fast);
+  printu("null syscall, slow path: %ld cycles per call\n", slow);
+
+  exit(0);
+  return 0;
+}
@@ -9,6 +9,10 @@
 #include "util/types.h"
 #include "util/snprintf.h"
 #include "kernel/syscall.h"
+#include "kernel/uring.h"
+#include "kernel/vdso.h"
+#include "kernel/perf.h"
+#include "kernel/config.h"
 
 long do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5, uint64 a6,
                  uint64 a7) {
@@ -18,7 +22,7 @@ long do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uin
   // registers (a0-a7) of our (emulated) risc-v machine.
   asm volatile(
       "ecall\n"
-      "sw a0, %0"  // returns a 32-bit value
+      "sd a0, %0"  // returns a 64-bit value
       : "=m"(ret)
       :
       : "memory");
@@ -26,6 +30,25 @@ long do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uin
   return ret;
 }
 
+//
+// stdout of the application is buffered in user space, and handed to the kernel (by
+// SYS_user_write) when the buffer fills up, on fflush(), and on exit().
+//
+static char stdout_buf[STDOUT_BUF_SIZE];
+static size_t stdout_len;
+
+int fflush(void) {
+  int ret = 0;
+  if (stdout_len) ret = do_user_call(SYS_user_write, (uint64)stdout_buf, stdout_len, 0, 0, 0, 0, 0);
+  stdout_len = 0;
+  return ret < 0 ? ret : 0;
+}
+
+static void stdout_putch(char ch, void* ctx) {
+  if (stdout_len == STDOUT_BUF_SIZE) fflush();
+  stdout_buf[stdout_len++] = ch;
+}
+
 //
 // printu() supports user/lab1_1_helloworld.c
 //
@@ -33,20 +56,18 @@ int printu(const char* s, ...) {
   va_list vl;
   va_start(vl, s);
 
-  char out[256];  // fixed buffer size.
-  int res = vsnprintf(out, sizeof(out), s, vl);
+  // format straight into the stdout buffer, so output of any length is kept.
+  int res = vprintfmt(stdout_putch, NULL, s, vl);
   va_end(vl);
-  const char* buf = out;
-  size_t n = res < sizeof(out) ? res : sizeof(out);
 
-  // make a syscall to implement the required functionality.
-  return do_user_call(SYS_user_print, (uint64)buf, n, 0, 0, 0, 0, 0);
+  return res;
 }
 
 //
 // applications need to call exit to quit execution.
 //
 int exit(int code) {
+  fflush();
   return do_user_call(SYS_user_exit, code, 0, 0, 0, 0, 0, 0); 
 }
 
@@ -55,6 +76,143 @@ int exit(int code) {
 
 // added in lab1_challenge1
 void print_backtrace(int depth) {
+  // the backtrace is printed by the kernel, write out what the application printed before.
+  fflush();
   do_user_call(SYS_print_backtrace, depth, 0, 0, 0, 0, 0, 0);
   return;
-}
\ No newline at end of file
+}
+
+//
+// query the call count and latency histogram of a syscall
+//
+int get_syscall_stat(int sysnum, struct syscall_stat_t *buf) {
+  return do_user_call(SYS_syscall_stat, sysnum, (uint64)buf, 0, 0, 0, 0, 0);
+}
+
+//
+// shared-memory syscall rings: requests are queued by uring_submit(), and served in a batch
+// by uring_enter() (or by the kernel on its next timer tick).
+//
+static uring* g_uring;
+
+int uring_setup(void) {
+  long va = do_user_call(SYS_uring_setup, 0, 0, 0, 0, 0, 0, 0);
+  if (va < 0) return -1;
+  g_uring = (uring*)va;
+  return 0;
+}
+
+int uring_submit(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 user_data) {
+  if (!g_uring) return -1;
+  // the submission ring is full, let the kernel serve it first.
+  if (g_uring->sq_tail - g_uring->sq_head == URING_ENTRIES) uring_enter();
+  if (g_uring->sq_tail - g_uring->sq_head == URING_ENTRIES) return -1;
+
+  uring_sqe* sqe = &g_uring->sqes[g_uring->sq_tail & (URING_ENTRIES - 1)];
+  sqe->sysnum = sysnum;
+  sqe->args[0] = a1;
+  sqe->args[1] = a2;
+  sqe->args[2] = a3;
+  sqe->args[3] = sqe->args[4] = sqe->args[5] = 0;
+  sqe->user_data = user_data;
+  // publish the request after its content.
+  asm volatile("fence" ::: "memory");
+  g_uring->sq_tail++;
+  return 0;
+}
+
+int uring_enter(void) {
+  return do_user_call(SYS_uring_enter, 0, 0, 0, 0, 0, 0, 0);
+}
+
+int uring_reap(uint64* user_data, long* res) {
+  if (!g_uring || g_uring->cq_head == g_uring->cq_tail) return 0;
+  asm volatile("fence" ::: "memory");
+  uring_cqe* cqe = &g_uring->cqes[g_uring->cq_head & (URING_ENTRIES - 1)];
+  *user_data = cqe->user_data;
+  *res = cqe->res;
+  g_uring->cq_head++;
+  return 1;
+}
+
+//
+// timers: block for a while without busy-looping, and read the time since boot.
+//
+int sleep(uint64 seconds) {
+  return do_user_call(SYS_sleep, seconds, 0, 0, 0, 0, 0, 0);
+}
+
+int nanosleep(const struct timespec_t *req, struct timespec_t *rem) {
+  return do_user_call(SYS_nanosleep, (uint64)req, (uint64)rem, 0, 0, 0, 0, 0);
+}
+
+//
+// read the time page (kernel/vdso.h) mapped by the kernel, without trapping. retry while the
+// kernel is updating it, i.e., if seq was odd or has changed.
+//
+static const vdso_time *const vdso_page = (const vdso_time *)USER_VDSO_VA;
+
+static void vdso_read(uint64 *ticks, uint64 *mtime) {
+  uint32 seq;
+  do {
+    seq = vdso_page->seq;
+    asm volatile("fence r,r" ::: "memory");
+    *ticks = vdso_page->ticks;
+    *mtime = vdso_page->mtime;
+    asm volatile("fence r,r" ::: "memory");
+  } while ((seq & 1) || seq != vdso_page->seq);
+}
+
+uint64 ticks(void) {
+  uint64 t, mtime;
+  vdso_read(&t, &mtime);
+  return t;
+}
+
+int clock_gettime(int clock, struct timespec_t *tp) {
+  if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC)
+    return do_user_call(SYS_clock_gettime, clock, (uint64)tp, 0, 0, 0, 0, 0);
+
+  uint64 t, mtime, tb = vdso_page->timebase;
+  vdso_read(&t, &mtime);
+  tp->tv_sec = mtime / tb;
+  tp->tv_nsec = mtime % tb * 1000000000ULL / tb;
+  return 0;
+}
+
+//
+// groups of hardware performance counters, read around a code region without trapping.
+//
+int perf_group_add(perf_group *g, uint64 event) {
+  if (g->n == PERF_GROUP_MAX) return -1;
+  long counter = do_user_call(SYS_perf_event_open, event, 0, 0, 0, 0, 0, 0);
+  if (counter < 0) return -1;
+  g->counter[g->n] = counter;
+  g->value[g->n] = 0;
+  return g->n++;
+}
+
+void perf_group_start(perf_group *g) {
+  for (int i = 0; i < g->n; i++) g->start[i] = perf_read_counter(g->counter[i]);
+}
+
+void perf_group_stop(perf_group *g) {
+  for (int i = 0; i < g->n; i++) g->value[i] += perf_read_counter(g->counter[i]) - g->start[i];
+}
+
+void perf_group_close(perf_group *g) {
+  for (int i = 0; i < g->n; i++) do_user_call(SYS_perf_event_close, g->counter[i], 0, 0, 0, 0, 0, 0);
+  g->n = 0;
+}
+
+void *sbrk(long incr) {
+  return (void *)do_user_call(SYS_sbrk, incr, 0, 0, 0, 0, 0, 0);
+}
+
+void *mmap(uint64 len, int prot) {
+  return (void *)do_user_call(SYS_mmap, len, prot, 0, 0, 0, 0, 0);
+}
+
+int munmap(void *addr, uint64 len) {
+  return do_user_call(SYS_munmap, (uint64)addr, len, 0, 0, 0, 0, 0);
+}
@@ -2,9 +2,73 @@
  * header file to be used by applications.
  */
 
+#include "util/types.h"
+
+// size of the user-level stdout buffer
+#define STDOUT_BUF_SIZE 4096
+
+// issue syscall sysnum with arguments a1-a7, returns the result of the syscall
+long do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5, uint64 a6,
+                  uint64 a7);
+
 int printu(const char *s, ...);
+int fflush(void);
 int exit(int code);
 
 // added in lab1_challenge1
 //char* 
-void print_backtrace(int depth);
\ No newline at end of file
+void print_backtrace(int depth);
+
+// copy the statistics of a syscall (struct syscall_stat_t, defined in kernel/syscall.h) to buf
+struct syscall_stat_t;
+int get_syscall_stat(int sysnum, struct syscall_stat_t *buf);
+
+// shared-memory syscall rings (kernel/uring.h). uring_submit() queues a syscall with up to
+// three arguments, uring_enter() lets the kernel serve all queued ones with a single trap,
+// and uring_reap() returns 1 and a result if a completion is available.
+int uring_setup(void);
+int uring_submit(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 user_data);
+int uring_enter(void);
+int uring_reap(uint64 *user_data, long *res);
+
+// block the process for a while, woken up by a kernel timer; read a clock (see CLOCK_* in
+// kernel/syscall.h) into tp. struct timespec_t is defined in kernel/syscall.h
+struct timespec_t;
+int sleep(uint64 seconds);
+int nanosleep(const struct timespec_t *req, struct timespec_t *rem);
+int clock_gettime(int clock, struct timespec_t *tp);
+// timer ticks of all harts since boot. clock_gettime() (except for CLOCK_MONOTONIC_RAW) and
+// ticks() read the time page mapped by the kernel, without trapping.
+uint64 ticks(void);
+
+// a group of hardware performance counters (kernel/perf.h). add events (PERF_EVENT_CYCLES,
+// PERF_EVENT_INSTRET or raw mhpmevent values) to a zeroed group, then enclose the measured
+// region by perf_group_start() and perf_group_stop(): value[i] accumulates the count of the
+// i-th event (as returned by perf_group_add()) over the regions.
+#define PERF_GROUP_MAX 8
+typedef struct perf_group_t {
+  int n;
+  int counter[PERF_GROUP_MAX];
+  uint64 start[PERF_GROUP_MAX];
+  uint64 value[PERF_GROUP_MAX];
+} perf_group;
+
+int perf_group_add(perf_group *g, uint64 event);
+void perf_group_start(perf_group *g);
+void perf_group_stop(perf_group *g);
+void perf_group_close(perf_group *g);
+
+// the program break and anonymous mappings. sbrk() returns the previous break, mmap() the
+// address of len zero-filled bytes; both return (void *)-1 on failure. munmap() takes a
+// whole mapping returned by mmap().
+#define PROT_READ 1
+#define PROT_WRITE 2
+void *sbrk(long incr);
+void *mmap(uint64 len, int prot);
+int munmap(void *addr, uint64 len);
+
+// the heap allocator (user/user_malloc.c). blocks are 16-byte aligned.
+void *malloc(uint64 size);
+void free(void *ptr);
+void *calloc(uint64 n, uint64 size);
+void *realloc(void *ptr, uint64 size);
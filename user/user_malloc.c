@@ -0,0 +1,235 @@
+/*
+ * The heap allocator of the user library, on top of SYS_sbrk and SYS_mmap.
+ *
+ * every block starts with an 8-byte header, holding the size of the block (a multiple of 16,
+ * header included) and the flags below, so that payloads are 16-byte aligned. blocks are:
+ *  - small (up to SMALL_MAX bytes): rounded up to a size class, a multiple of 16. freed small
+ *    blocks are kept in a LIFO bin per class, and reused as they are, never split nor merged.
+ *    a process has a single thread, so the bins act as its thread cache and need no locks.
+ *  - large: taken first-fit from a list of free large blocks and split, and merged with their
+ *    free neighbours when freed, by boundary tags: a free large block ends with a copy of its
+ *    size, and the block right after it has PREV_FREE set.
+ *  - huge (from MMAP_THRESHOLD bytes on): mapped by mmap() one by one, unmapped when freed.
+ * small and large blocks that are not found in the bins (resp. the free list) are carved from
+ * the top of the heap by bumping a pointer. the heap grows by sbrk() in HEAP_CHUNK steps, so
+ * applications that use malloc() must not move the program break themselves.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+#include "util/string.h"
+#include "util/functions.h"
+
+#define ALIGN 16
+#define HDR_SIZE 8
+// the smallest block holds a header, the links of a free block and a footer
+#define MIN_BLOCK 32
+// a free large block is split if at least this much is left
+#define MIN_SPLIT 64
+
+#define SMALL_MAX 1024
+#define MMAP_THRESHOLD (128 * 1024)
+#define HEAP_CHUNK (64 * 1024)
+// larger requests fail right away, before the size computations overflow
+#define MALLOC_MAX (1UL << 32)
+
+// flags in the low bits of a header
+#define IN_USE 1     // allocated, or in a bin
+#define PREV_FREE 2  // the block before is a free large block, whose footer is right before
+#define SMALL 4
+#define MMAPPED 8
+#define FLAGS (ALIGN - 1)
+
+typedef struct block_t {
+  uint64 head;  // size | flags
+  // links of a free block, in the first bytes of the payload. only large blocks use prev.
+  struct block_t *next;
+  struct block_t *prev;
+} block;
+
+#define SIZE(b) ((b)->head & ~(uint64)FLAGS)
+#define NEXT_BLOCK(b) ((block *)((char *)(b) + SIZE(b)))
+#define PAYLOAD(b) ((void *)((char *)(b) + HDR_SIZE))
+#define BLOCK_OF(p) ((block *)((char *)(p)-HDR_SIZE))
+#define FOOTER(b) (*(uint64 *)((char *)NEXT_BLOCK(b) - sizeof(uint64)))
+
+// bins[size / ALIGN] holds the free small blocks of that size
+static block *bins[SMALL_MAX / ALIGN + 1];
+// free large blocks
+static block *large_free;
+// the unused top of the heap is [top, heap_end). heap_end is the program break.
+static char *top, *heap_end;
+
+static void large_link(block *b) {
+  b->prev = NULL;
+  b->next = large_free;
+  if (large_free) large_free->prev = b;
+  large_free = b;
+}
+
+static void large_unlink(block *b) {
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    large_free = b->next;
+  if (b->next) b->next->prev = b->prev;
+}
+
+//
+// move the program break so that the top of the heap has room for size more bytes.
+// returns 0, or -1 if the heap cannot grow (contiguously).
+//
+static int heap_grow(uint64 size) {
+  if (!heap_end) {
+    char *brk = sbrk(0);
+    if (brk == (char *)-1) return -1;
+    // headers sit 8 bytes below the 16-byte aligned payloads
+    heap_end = brk;
+    top = brk + (ALIGN - ((uint64)brk + HDR_SIZE) % ALIGN) % ALIGN;
+  }
+
+  uint64 incr = ROUNDUP((uint64)(top + size - heap_end), HEAP_CHUNK);
+  char *old = sbrk(incr);
+  if (old == (char *)-1) return -1;
+  if (old != heap_end) {
+    sbrk(-(long)incr);
+    return -1;
+  }
+  heap_end += incr;
+  return 0;
+}
+
+// the bump-pointer path: carve a block of size bytes from the top of the heap
+static block *heap_bump(uint64 size) {
+  if (top + size > heap_end && heap_grow(size) != 0) return NULL;
+  block *b = (block *)top;
+  top += size;
+  // the block before the top is never free: a free block there is merged into the top
+  b->head = size | IN_USE;
+  return b;
+}
+
+// give the top of the heap back to the kernel, keeping a chunk for later allocations
+static void heap_trim(void) {
+  uint64 excess = ROUNDDOWN((uint64)(heap_end - top), HEAP_CHUNK);
+  if (excess < 2 * HEAP_CHUNK) return;
+  excess -= HEAP_CHUNK;
+  if (sbrk(-(long)excess) != (void *)-1) heap_end -= excess;
+}
+
+static void *large_alloc(uint64 size) {
+  for (block *b = large_free; b; b = b->next) {
+    uint64 bsize = SIZE(b);
+    if (bsize < size) continue;
+
+    large_unlink(b);
+    if (bsize - size >= MIN_SPLIT) {
+      // the rest stays free, and the block after it keeps PREV_FREE
+      block *rest = (block *)((char *)b + size);
+      rest->head = bsize - size;
+      FOOTER(rest) = bsize - size;
+      large_link(rest);
+      b->head = size | IN_USE;
+    } else {
+      b->head |= IN_USE;
+      NEXT_BLOCK(b)->head &= ~(uint64)PREV_FREE;
+    }
+    return PAYLOAD(b);
+  }
+
+  block *b = heap_bump(size);
+  return b ? PAYLOAD(b) : NULL;
+}
+
+static void large_free_block(block *b) {
+  uint64 size = SIZE(b);
+  block *next = NEXT_BLOCK(b);
+
+  // merge with the free neighbours
+  if ((char *)next != top && !(next->head & IN_USE)) {
+    large_unlink(next);
+    size += SIZE(next);
+  }
+  if (b->head & PREV_FREE) {
+    uint64 prev_size = *(uint64 *)((char *)b - sizeof(uint64));
+    b = (block *)((char *)b - prev_size);
+    large_unlink(b);
+    size += prev_size;
+  }
+
+  if ((char *)b + size == top) {
+    top = (char *)b;
+    heap_trim();
+    return;
+  }
+  b->head = size;
+  FOOTER(b) = size;
+  NEXT_BLOCK(b)->head |= PREV_FREE;
+  large_link(b);
+}
+
+static void *huge_alloc(uint64 size) {
+  char *va = mmap(size + ALIGN - HDR_SIZE, PROT_READ | PROT_WRITE);
+  if (va == (char *)-1) return NULL;
+  block *b = (block *)(va + ALIGN - HDR_SIZE);
+  b->head = size | IN_USE | MMAPPED;
+  return PAYLOAD(b);
+}
+
+void *malloc(uint64 size) {
+  if (size > MALLOC_MAX) return NULL;
+  uint64 bsize = MAX(ROUNDUP(size + HDR_SIZE, ALIGN), MIN_BLOCK);
+
+  if (bsize <= SMALL_MAX) {
+    block **bin = &bins[bsize / ALIGN];
+    block *b = *bin;
+    if (b) {
+      *bin = b->next;
+      return PAYLOAD(b);
+    }
+    if (!(b = heap_bump(bsize))) return NULL;
+    b->head |= SMALL;
+    return PAYLOAD(b);
+  }
+
+  return bsize < MMAP_THRESHOLD ? large_alloc(bsize) : huge_alloc(bsize);
+}
+
+void free(void *ptr) {
+  if (!ptr) return;
+  block *b = BLOCK_OF(ptr);
+
+  if (b->head & SMALL) {
+    block **bin = &bins[SIZE(b) / ALIGN];
+    b->next = *bin;
+    *bin = b;
+  } else if (b->head & MMAPPED) {
+    munmap((char *)b - (ALIGN - HDR_SIZE), SIZE(b) + ALIGN - HDR_SIZE);
+  } else {
+    large_free_block(b);
+  }
+}
+
+void *calloc(uint64 n, uint64 size) {
+  if (size && n > MALLOC_MAX / size) return NULL;
+  void *p = malloc(n * size);
+  if (p) memset(p, 0, n * size);
+  return p;
+}
+
+void *realloc(void *ptr, uint64 size) {
+  if (!ptr) return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  uint64 avail = SIZE(BLOCK_OF(ptr)) - HDR_SIZE;
+  if (size <= avail) return ptr;
+  void *p = malloc(size);
+  if (p) {
+    memcpy(p, ptr, avail);
+    free(ptr);
+  }
+  return p;
+}
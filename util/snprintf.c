@@ -8,7 +8,11 @@
 
 #include "util/snprintf.h"
 
-int32 vsnprintf(char* out, size_t n, const char* s, va_list vl) {
+//
+// format s into a stream of characters, each emitted by calling putch(ch, ctx).
+// returns the number of characters emitted.
+//
+int32 vprintfmt(void (*putch)(char, void*), void* ctx, const char* s, va_list vl) {
   bool format = FALSE;
   bool longarg = FALSE;
   size_t pos = 0;
@@ -21,13 +25,13 @@ int32 vsnprintf(char* out, size_t n, const char* s, va_list vl) {
           break;
         case 'p':
           longarg = TRUE;
-          if (++pos < n) out[pos - 1] = '0';
-          if (++pos < n) out[pos - 1] = 'x';
+          putch('0', ctx), pos++;
+          putch('x', ctx), pos++;
         case 'x': {
           long num = longarg ? va_arg(vl, long) : va_arg(vl, int);
           for (int i = 2 * (longarg ? sizeof(long) : sizeof(int)) - 1; i >= 0; i--) {
             int d = (num >> (4 * i)) & 0xF;
-            if (++pos < n) out[pos - 1] = (d < 10 ? '0' + d : 'a' + d - 10);
+            putch(d < 10 ? '0' + d : 'a' + d - 10, ctx), pos++;
           }
           longarg = FALSE;
           format = FALSE;
@@ -37,32 +41,28 @@ int32 vsnprintf(char* out, size_t n, const char* s, va_list vl) {
           long num = longarg ? va_arg(vl, long) : va_arg(vl, int);
           if (num < 0) {
             num = -num;
-            if (++pos < n) out[pos - 1] = '-';
+            putch('-', ctx), pos++;
           }
-          long digits = 1;
-          for (long nn = num; nn /= 10; digits++)
-            ;
-          for (int i = digits - 1; i >= 0; i--) {
-            if (pos + i + 1 < n) out[pos + i] = '0' + (num % 10);
+          char digits[24];
+          int n = 0;
+          do {
+            digits[n++] = '0' + (num % 10);
             num /= 10;
-          }
-          pos += digits;
+          } while (num);
+          while (n > 0) putch(digits[--n], ctx), pos++;
           longarg = FALSE;
           format = FALSE;
           break;
         }
         case 's': {
           const char* s2 = va_arg(vl, const char*);
-          while (*s2) {
-            if (++pos < n) out[pos - 1] = *s2;
-            s2++;
-          }
+          while (*s2) putch(*s2++, ctx), pos++;
           longarg = FALSE;
           format = FALSE;
           break;
         }
         case 'c': {
-          if (++pos < n) out[pos - 1] = (char)va_arg(vl, int);
+          putch((char)va_arg(vl, int), ctx), pos++;
           longarg = FALSE;
           format = FALSE;
           break;
@@ -72,12 +72,38 @@ int32 vsnprintf(char* out, size_t n, const char* s, va_list vl) {
       }
     } else if (*s == '%')
       format = TRUE;
-    else if (++pos < n)
-      out[pos - 1] = *s;
+    else
+      putch(*s, ctx), pos++;
   }
-  if (pos < n)
-    out[pos] = 0;
+  return pos;
+}
+
+struct sprint_buf {
+  char* out;
+  size_t n;
+  size_t pos;
+};
+
+static void sprint_putch(char ch, void* ctx) {
+  struct sprint_buf* b = (struct sprint_buf*)ctx;
+  if (++b->pos < b->n) b->out[b->pos - 1] = ch;
+}
+
+int32 vsnprintf(char* out, size_t n, const char* s, va_list vl) {
+  struct sprint_buf b = {out, n, 0};
+  vprintfmt(sprint_putch, &b, s, vl);
+
+  if (b.pos < n)
+    out[b.pos] = 0;
   else if (n)
     out[n - 1] = 0;
-  return pos;
+  return b.pos;
+}
+
+int32 snprintf(char* out, size_t n, const char* s, ...) {
+  va_list vl;
+  va_start(vl, s);
+  int res = vsnprintf(out, n, s, vl);
+  va_end(vl);
+  return res;
 }
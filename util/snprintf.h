@@ -6,6 +6,8 @@
 
 #include "util/types.h"
 
+int vprintfmt(void (*putch)(char, void*), void* ctx, const char* s, va_list vl);
 int vsnprintf(char* out, size_t n, const char* s, va_list vl);
+int snprintf(char* out, size_t n, const char* s, ...);
 
 #endif
@@ -23,18 +23,32 @@ void* memcpy(void* dest, const void* src, size_t len) {
 }
 
 void* memset(void* dest, int byte, size_t len) {
-  if ((((uintptr_t)dest | len) & (sizeof(uintptr_t) - 1)) == 0) {
+  char* d = dest;
+  char* end = d + len;
+
+  if (len >= 4 * sizeof(uintptr_t)) {
     uintptr_t word = byte & 0xFF;
     word |= word << 8;
     word |= word << 16;
     word |= word << 16 << 16;
 
-    uintptr_t* d = dest;
-    while (d < (uintptr_t*)(dest + len)) *d++ = word;
-  } else {
-    char* d = dest;
-    while (d < (char*)(dest + len)) *d++ = byte;
+    // fill the unaligned head byte by byte, then the bulk of the block in words
+    while ((uintptr_t)d & (sizeof(uintptr_t) - 1)) *d++ = byte;
+
+    uintptr_t* w = (uintptr_t*)d;
+    uintptr_t* wend = (uintptr_t*)((uintptr_t)end & ~(sizeof(uintptr_t) - 1));
+    while (w + 4 <= wend) {
+      w[0] = word;
+      w[1] = word;
+      w[2] = word;
+      w[3] = word;
+      w += 4;
+    }
+    while (w < wend) *w++ = word;
+    d = (char*)w;
   }
+
+  while (d < end) *d++ = byte;
   return dest;
 }
 